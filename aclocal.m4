@@ -1,4 +1,4 @@
-dnl $Id: aclocal.m4,v 1.11 2025/10/26 14:09:49 tom Exp $
+dnl $Id: aclocal.m4,v 1.12 2026/10/17 12:00:00 tom Exp $
 dnl Macros for rcshist configure script (Thomas E. Dickey)
 dnl ---------------------------------------------------------------------------
 dnl Copyright 2015-2023,2025 Thomas E. Dickey
@@ -1259,6 +1259,50 @@ AC_SUBST(LINT_OPTS)
 AC_SUBST(LINT_LIBS)
 ])dnl
 dnl ---------------------------------------------------------------------------
+dnl CF_PTHREADS version: 1 updated: 2026/10/17 12:00:00
+dnl -----------
+dnl Find how to link with POSIX threads: with nothing added, with -lpthread,
+dnl or with the compiler's -pthread option.  The last goes in $CFLAGS, which
+dnl the makefile also uses when linking.
+AC_DEFUN([CF_PTHREADS],[
+AC_CACHE_CHECK(how to link with POSIX threads,cf_cv_pthreads,[
+	cf_cv_pthreads=unknown
+	cf_save_LIBS="$LIBS"
+	cf_save_CFLAGS="$CFLAGS"
+	for cf_pthreads in none -lpthread -pthread
+	do
+		case "$cf_pthreads" in
+		(-lpthread)
+			LIBS="-lpthread $cf_save_LIBS"
+			;;
+		(-pthread)
+			CFLAGS="$cf_save_CFLAGS -pthread"
+			;;
+		esac
+		AC_TRY_LINK([#include <pthread.h>],[
+			pthread_t thread;
+			pthread_create(&thread, 0, 0, 0);
+			pthread_join(thread, 0)],
+			[cf_cv_pthreads=$cf_pthreads])
+		LIBS="$cf_save_LIBS"
+		CFLAGS="$cf_save_CFLAGS"
+		test "$cf_cv_pthreads" != unknown && break
+	done
+])
+
+case "$cf_cv_pthreads" in
+(unknown)
+	AC_MSG_ERROR(cannot find how to link with POSIX threads)
+	;;
+(-lpthread)
+	LIBS="-lpthread $LIBS"
+	;;
+(-pthread)
+	CF_APPEND_TEXT(CFLAGS,-pthread)
+	;;
+esac
+])dnl
+dnl ---------------------------------------------------------------------------
 dnl CF_REMOVE_CFLAGS version: 3 updated: 2021/09/05 17:25:40
 dnl ----------------
 dnl Remove a given option from CFLAGS/CPPFLAGS
@@ -1294,6 +1338,24 @@ $1=`echo "$2" | \
 		-e 's/-[[UD]]'"$3"'\(=[[^ 	]]*\)\?[$]//g'`
 ])dnl
 dnl ---------------------------------------------------------------------------
+dnl CF_STAT_ST_MTIM version: 1 updated: 2026/10/18 12:00:00
+dnl ---------------
+dnl Check if struct stat has the POSIX.1-2008 st_mtim and st_ctim members,
+dnl which give the times to the nanosecond.
+AC_DEFUN([CF_STAT_ST_MTIM],[
+AC_CACHE_CHECK(if struct stat has st_mtim,cf_cv_stat_st_mtim,[
+	AC_TRY_COMPILE([
+#include <sys/types.h>
+#include <sys/stat.h>],[
+		struct stat sb;
+		long nsec = sb.st_mtim.tv_nsec + sb.st_ctim.tv_nsec;
+		(void) nsec],
+		[cf_cv_stat_st_mtim=yes],
+		[cf_cv_stat_st_mtim=no])
+])
+test "$cf_cv_stat_st_mtim" = yes && AC_DEFINE(HAVE_STRUCT_STAT_ST_MTIM,1,[Define to 1 if struct stat has st_mtim and st_ctim])
+])dnl
+dnl ---------------------------------------------------------------------------
 dnl CF_TRY_XOPEN_SOURCE version: 4 updated: 2022/09/10 15:16:16
 dnl -------------------
 dnl If _XOPEN_SOURCE is not defined in the compile environment, check if we
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2026 Thomas E. Dickey <dickey@invisible-island.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id: arena.c,v 1.1 2026/10/17 12:00:00 tom Exp $
+ */
+
+#include "rcshist.h"
+#include "arena.h"
+
+#define ARENA_MIN	4096
+#define ARENA_MAX	(1024 * 1024)
+#define ARENA_ALIGN	sizeof(union arena_align)
+
+union arena_align {
+	long l;
+	double d;
+	void *p;
+};
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	union arena_align data[1];
+};
+
+struct arena {
+	struct arena_block *blocks;
+	char *pos;			/* free space in blocks */
+	char *end;
+	size_t blocksize;		/* size of the next block */
+};
+
+struct arena *
+arena_create(void) {
+	struct arena *ap = malloc(sizeof(*ap));
+
+	ap->blocks = NULL;
+	ap->pos = NULL;
+	ap->end = NULL;
+	ap->blocksize = ARENA_MIN;
+
+	return ap;
+}
+
+void *
+arena_alloc(struct arena *ap, size_t size) {
+	struct arena_block *bp;
+	char *p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if (size > (size_t)(ap->end - ap->pos)) {
+		/*
+		 * Blocks double in size up to ARENA_MAX.  Anything bigger
+		 * than a quarter of that gets a block of its own, so the
+		 * current block isn't abandoned for it.
+		 */
+		if (size > ARENA_MAX / 4) {
+			bp = malloc(offsetof(struct arena_block, data) + size);
+			bp->size = size;
+			if (ap->blocks != NULL) {
+				bp->next = ap->blocks->next;
+				ap->blocks->next = bp;
+			} else {
+				bp->next = NULL;
+				ap->blocks = bp;
+			}
+			return bp->data;
+		}
+
+		while (ap->blocksize < size)
+			ap->blocksize *= 2;
+		bp = malloc(offsetof(struct arena_block, data) +
+		    ap->blocksize);
+		bp->size = ap->blocksize;
+		bp->next = ap->blocks;
+		ap->blocks = bp;
+		ap->pos = (char *)bp->data;
+		ap->end = ap->pos + bp->size;
+		if (ap->blocksize < ARENA_MAX)
+			ap->blocksize *= 2;
+	}
+
+	p = ap->pos;
+	ap->pos += size;
+	return p;
+}
+
+void *
+arena_calloc(struct arena *ap, size_t size) {
+	void *p = arena_alloc(ap, size);
+
+	bzero(p, size);
+	return p;
+}
+
+void
+arena_destroy(struct arena *ap) {
+	struct arena_block *bp;
+
+	while ((bp = ap->blocks) != NULL) {
+		ap->blocks = bp->next;
+		free(bp);
+	}
+	free(ap);
+}
@@ -27,6 +27,8 @@
 
 #include "rcshist.h"
 #include "misc.h"
+#include "arena.h"
+#include "outbuf.h"
 
 struct textlist *
 textlist_create(void) {
@@ -36,12 +38,34 @@ textlist_create(void) {
 	tlp->list = NULL;
 	tlp->len = 0;
 	tlp->list_len = 0;
+	tlp->arena = NULL;
 
 	return tlp;
 }
 
+/*
+ * Create a textlist which lives in the arena ap, along with its list.
+ */
+struct textlist *
+textlist_acreate(struct arena *ap) {
+	struct textlist *tlp;
+
+	tlp = arena_alloc(ap, sizeof(*tlp));
+	tlp->list = NULL;
+	tlp->len = 0;
+	tlp->list_len = 0;
+	tlp->arena = ap;
+
+	return tlp;
+}
+
+/*
+ * A textlist in an arena goes with the arena; this does nothing to it.
+ */
 void
 textlist_destroy(struct textlist *tlp) {
+	if (tlp->arena != NULL)
+		return;
 	if (tlp->list != NULL)
 		free(tlp->list);
 	free(tlp);
@@ -51,13 +75,196 @@ void
 textlist_add(struct textlist *tlp, struct rcstext *text) {
 	if (tlp->list_len == tlp->len) {
 		tlp->list_len += tlp->list_len + 1;
-		tlp->list = realloc(tlp->list, (size_t)tlp->list_len *
-		    sizeof(*tlp->list));
+		if (tlp->arena != NULL) {
+			struct rcstext *list;
+
+			list = arena_alloc(tlp->arena, (size_t)tlp->list_len *
+			    sizeof(*tlp->list));
+			if (tlp->len != 0)
+				bcopy(tlp->list, list, (size_t)tlp->len *
+				    sizeof(*tlp->list));
+			tlp->list = list;
+		} else
+			tlp->list = realloc(tlp->list, (size_t)tlp->list_len *
+			    sizeof(*tlp->list));
 	}
 
 	tlp->list[tlp->len++] = *text;
 }
 
+/*
+ * Make room for at least n entries in an empty list.
+ */
+void
+textlist_reserve(struct textlist *tlp, long n) {
+	if (tlp->len != 0 || n <= tlp->list_len)
+		return;
+	if (tlp->arena != NULL)
+		tlp->list = arena_alloc(tlp->arena, (size_t)n *
+		    sizeof(*tlp->list));
+	else
+		tlp->list = realloc(tlp->list, (size_t)n * sizeof(*tlp->list));
+	tlp->list_len = n;
+}
+
+/*
+ * Create an empty piecetable, in the arena ap if it isn't NULL.
+ */
+struct piecetable *
+pt_create(struct arena *ap) {
+	struct piecetable *ptp;
+
+	ptp = (ap != NULL) ? arena_alloc(ap, sizeof(*ptp)) :
+	    malloc(sizeof(*ptp));
+	ptp->list = NULL;
+	ptp->len = 0;
+	ptp->list_len = 0;
+	ptp->nlines = 0;
+	ptp->arena = ap;
+
+	return ptp;
+}
+
+/*
+ * Like textlist_destroy(), this does nothing to a table in an arena.
+ */
+void
+pt_destroy(struct piecetable *ptp) {
+	if (ptp->arena != NULL)
+		return;
+	if (ptp->list != NULL)
+		free(ptp->list);
+	free(ptp);
+}
+
+/*
+ * Append the len lines at start, joining them to the last piece if they
+ * follow on from it.
+ */
+void
+pt_add(struct piecetable *ptp, struct rcstext *start, long len) {
+	struct piece *pcp;
+
+	if (len == 0)
+		return;
+	ptp->nlines += len;
+	if (ptp->len != 0) {
+		pcp = &ptp->list[ptp->len - 1];
+		if (pcp->start + pcp->len == start) {
+			pcp->len += len;
+			return;
+		}
+	}
+
+	if (ptp->list_len == ptp->len) {
+		ptp->list_len += ptp->list_len + 4;
+		if (ptp->arena != NULL) {
+			struct piece *list;
+
+			list = arena_alloc(ptp->arena, (size_t)ptp->list_len *
+			    sizeof(*ptp->list));
+			if (ptp->len != 0)
+				bcopy(ptp->list, list, (size_t)ptp->len *
+				    sizeof(*ptp->list));
+			ptp->list = list;
+		} else
+			ptp->list = realloc(ptp->list, (size_t)ptp->list_len *
+			    sizeof(*ptp->list));
+	}
+
+	pcp = &ptp->list[ptp->len++];
+	pcp->start = start;
+	pcp->len = len;
+}
+
+/*
+ * Make room for at least n pieces in an empty table.
+ */
+void
+pt_reserve(struct piecetable *ptp, long n) {
+	if (ptp->len != 0 || n <= ptp->list_len)
+		return;
+	if (ptp->arena != NULL)
+		ptp->list = arena_alloc(ptp->arena, (size_t)n *
+		    sizeof(*ptp->list));
+	else
+		ptp->list = realloc(ptp->list, (size_t)n * sizeof(*ptp->list));
+	ptp->list_len = n;
+}
+
+/*
+ * Append len lines of another table, starting at pos.
+ */
+void
+pt_addpieces(struct piecetable *ptp, const struct piecepos *pos, long len) {
+	const struct piece *pcp = pos->pc;
+	long off = pos->off;
+	long k;
+
+	while (len > 0) {
+		if (off == pcp->len) {
+			pcp++;
+			off = 0;
+		}
+		k = (pcp->len - off < len) ? pcp->len - off : len;
+		pt_add(ptp, pcp->start + off, k);
+		off += k;
+		len -= k;
+	}
+}
+
+/*
+ * Point pos at the given line of ptp.  This is quick when the lines are
+ * visited in order, as patches do.  pos->pc must be NULL the first time.
+ */
+void
+pt_seek(const struct piecetable *ptp, struct piecepos *pos, long line) {
+	if (pos->pc == NULL || line < pos->line - pos->off) {
+		pos->pc = ptp->list;
+		pos->line = 0;
+	} else
+		pos->line -= pos->off;
+	while (pos->pc < &ptp->list[ptp->len] &&
+	    pos->line + pos->pc->len <= line) {
+		pos->line += pos->pc->len;
+		pos->pc++;
+	}
+	pos->off = line - pos->line;
+	pos->line = line;
+}
+
+/*
+ * Step pos over n lines, a piece at a time.
+ */
+void
+pt_skip(struct piecepos *pos, long n) {
+	long k;
+
+	while (n > 0) {
+		if (pos->off == pos->pc->len) {
+			pos->pc++;
+			pos->off = 0;
+		}
+		k = (pos->pc->len - pos->off < n) ? pos->pc->len - pos->off : n;
+		pos->off += k;
+		pos->line += k;
+		n -= k;
+	}
+}
+
+/*
+ * Return the line at pos, and step pos past it.
+ */
+struct rcstext *
+pt_next(struct piecepos *pos) {
+	if (pos->off == pos->pc->len) {
+		pos->pc++;
+		pos->off = 0;
+	}
+	pos->line++;
+	return &pos->pc->start[pos->off++];
+}
+
 int
 txtequ(struct rcstext *p1, struct rcstext *p2) {
 	return p1->len == p2->len && bcmp(p1->start, p2->start, (size_t)p1->len) == 0;
@@ -88,31 +295,56 @@ numcmp(const struct rcsnum *p1, const struct rcsnum *p2) {
 
 void
 numcpy(const struct rcsnum *p1, struct rcsnum *p2) {
-	p2->len = p1->len;
-	p2->num = malloc((size_t)RCSNUM_BYTES(p1));
+	numalloc(p2, p1->len, NULL);
 	bcopy(p1->num, p2->num, (size_t)RCSNUM_BYTES(p2));
 }
 
+/*
+ * Make room for len components in an empty rcsnum.
+ */
+void
+numalloc(struct rcsnum *p, int len, struct arena *ap) {
+	p->len = len;
+	if (len <= RCSNUM_INLINE)
+		p->num = p->inum;
+	else if (ap != NULL)
+		p->num = arena_alloc(ap, (size_t)RCSNUM_BYTES(p));
+	else
+		p->num = malloc((size_t)RCSNUM_BYTES(p));
+}
+
 void
 numextend(struct rcsnum *p, int len) {
+	if (p->num != p->inum && p->num != NULL)
+		p->num = realloc(p->num, (size_t)len * sizeof(*p->num));
+	else if (len > RCSNUM_INLINE) {
+		p->num = malloc((size_t)len * sizeof(*p->num));
+		bcopy(p->inum, p->num, (size_t)RCSNUM_BYTES(p));
+	} else
+		p->num = p->inum;
 	p->len = len;
-	p->num = realloc(p->num, (size_t)RCSNUM_BYTES(p));
 }
 
 
 void
 numfree(struct rcsnum *p) {
-	free(p->num);
+	if (p->num != p->inum)
+		free(p->num);
 	p->num = NULL;
+	p->len = 0;
 }
 
-void
-text2num(struct rcstext *textp, struct rcsnum *nump) {
+/*
+ * Convert a revision number or date to a struct rcsnum.  Returns -1 if
+ * it is not well formed, leaving nump as it was.
+ */
+int
+text2num(struct rcstext *textp, struct rcsnum *nump, struct arena *ap) {
 	int i;
 	const char *p, *endp;
 
-	if (nump->num != NULL) {
-		printf("text2num: non-NULL num ptr\n");
+	if (nump->len != 0) {
+		out_str("text2num: non-NULL num ptr\n");
 		GIVE_UP();
 	}
 
@@ -124,31 +356,32 @@ text2num(struct rcstext *textp, struct rcsnum *nump) {
 		p++;
 	}
 
-	nump->len = i + 1;
-	nump->num = malloc((size_t)RCSNUM_BYTES(nump));
+	numalloc(nump, i + 1, ap);
 
 	p = textp->start;
 	for (i = 0; i < nump->len; i++) {
 		int n;
 
-		if (*p < '0' || *p > '9') {
-			printf("text2num: parse failed '%.*s'\n",
-			    textp->len, textp->start);
-			GIVE_UP();
-		}
+		if (p >= endp || *p < '0' || *p > '9')
+			goto fail;
 
 		n = 0;
 		while (p < endp && *p >= '0' && *p <= '9')
 			n = (n * 10) + (*p++ - '0');
 
-		if (p < endp && *p++ != '.') {
-			printf("text2num: parse failed '%.*s'\n",
-			    textp->len, textp->start);
-			GIVE_UP();
-		}
+		if (p < endp && *p++ != '.')
+			goto fail;
 
 		nump->num[i] = n;
 	}
+	return 0;
+
+fail:
+	if (ap == NULL)
+		numfree(nump);
+	else
+		numinit(nump);
+	return -1;
 }
 
 void
@@ -158,22 +391,35 @@ textprint(struct rcstext *textp) {
 	const char *end = textp->start + textp->len;
 
 	while (p < end && (p1 = memchr(p, '@', (size_t)(end - p))) != NULL) {
-		fwrite(p, (size_t)(p1 - p + 1), 1, stdout);
+		out_write(p, (size_t)(p1 - p + 1));
 		p = p1 + 2;
 	}
 	if (p < end)
-		fwrite(p, (size_t)(end - p), 1, stdout);
+		out_write(p, (size_t)(end - p));
 }
 
+/*
+ * Split textp into lines.  The lines are counted first, so that the list
+ * is allocated once, at its full size.
+ */
 struct textlist *
-textsplit(struct rcstext *textp) {
+textsplit(struct rcstext *textp, struct arena *ap) {
 	struct rcstext line;
 	const char *p, *end;
-	struct textlist *tlp = textlist_create();
+	struct textlist *tlp;
+	long n;
+
+	tlp = (ap != NULL) ? textlist_acreate(ap) : textlist_create();
 
 	p = textp->start;
 	end = textp->start + textp->len;
 
+	for (n = 0; p != NULL && p < end; n++)
+		if ((p = memchr(p, '\n', (size_t)(end - p))) != NULL)
+			p++;
+	textlist_reserve(tlp, n);
+
+	p = textp->start;
 	while (p != NULL && p < end) {
 		line.start = p;
 
@@ -181,7 +427,7 @@ textsplit(struct rcstext *textp) {
 			p = end;
 		else
 			p++;
-		line.len = (int)(p - line.start);
+		line.len = (long)(p - line.start);
 
 		textlist_add(tlp, &line);
 	}
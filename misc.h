@@ -27,22 +27,41 @@
 #ifndef MISC_H
 #define MISC_H
 
+#include <stdint.h>
+
+struct arena;
+
 struct rcstext {
 	const char *start;
-	int len;
+	int64_t len;			/* bytes */
 };
 
+/*
+ * Revision numbers and dates of up to RCSNUM_INLINE components are kept
+ * in inum, and num points there; longer ones are malloc'd, or taken from
+ * an arena if one is given, in which case numfree() must not be used.
+ * Since num may point into the struct itself, copy one with numcpy(), not
+ * by assignment.  RCSNUM_INLINE is as many as fill the struct to 32 bytes
+ * on LP64, enough for a revision on a first-level branch; a date has six.
+ */
+#define RCSNUM_INLINE	5
+
 struct rcsnum {
 	int *num;
 	int len;
+	int inum[RCSNUM_INLINE];
 };
 
 #define RCSNUM_BYTES(nump) (int)((size_t)(nump)->len * sizeof(*(nump)->num))
+/* The same, less the last component: the branch a revision is on */
+#define RCSNUM_BRBYTES(nump) \
+	(int)((size_t)((nump)->len - 1) * sizeof(*(nump)->num))
 
 struct textlist {
 	struct rcstext *list;
-	int len;
-	int list_len;
+	long len;
+	long list_len;
+	struct arena *arena;		/* where list comes from, or NULL */
 };
 
 #define TEXTLIST_FOREACH(listp, p) \
@@ -50,19 +69,64 @@ struct textlist {
 	    (p) != NULL && (p) < &(listp)->list[(listp)->len]; (p)++)
 
 struct textlist *textlist_create(void);
+struct textlist *textlist_acreate(struct arena *ap);
 void textlist_destroy(struct textlist *tlp);
 void textlist_add(struct textlist *tlp, struct rcstext *text);
+void textlist_reserve(struct textlist *tlp, long n);
 int txtequ(struct rcstext *p1, struct rcstext *p2);
 
+/*
+ * The lines of a revision, kept as runs of consecutive lines in arrays
+ * which are never changed once built: the text of the head revision and
+ * the lines added by each delta.  A revision shares the runs with the one
+ * it was patched from, so it costs a piece per change, not per line.
+ */
+struct piece {
+	struct rcstext *start;
+	long len;
+};
+
+struct piecetable {
+	struct piece *list;
+	long len;
+	long list_len;
+	long nlines;			/* total of the pieces' len */
+	struct arena *arena;		/* where list comes from, or NULL */
+};
+
+/* A line of a piecetable, found by pt_seek() */
+struct piecepos {
+	const struct piece *pc;
+	long off;			/* line within *pc */
+	long line;			/* line within the table */
+};
+
+#define PIECETABLE_FOREACH(ptp, pcp, textp) \
+	for ((pcp) = (ptp)->list; \
+	    (pcp) != NULL && (pcp) < &(ptp)->list[(ptp)->len]; (pcp)++) \
+		for ((textp) = (pcp)->start; \
+		    (textp) < &(pcp)->start[(pcp)->len]; (textp)++)
+
+struct piecetable *pt_create(struct arena *ap);
+void pt_destroy(struct piecetable *ptp);
+void pt_add(struct piecetable *ptp, struct rcstext *start, long len);
+void pt_reserve(struct piecetable *ptp, long n);
+void pt_addpieces(struct piecetable *ptp, const struct piecepos *pos,
+    long len);
+void pt_seek(const struct piecetable *ptp, struct piecepos *pos, long line);
+void pt_skip(struct piecepos *pos, long n);
+struct rcstext *pt_next(struct piecepos *pos);
+
 void numinit(struct rcsnum *p);
 int numequ(const struct rcsnum *p1, const struct rcsnum *p2);
 int numcmp(const struct rcsnum *p1, const struct rcsnum *p2);
 void numcpy(const struct rcsnum *p1, struct rcsnum *p2);
+void numalloc(struct rcsnum *p, int len, struct arena *ap);
 void numextend(struct rcsnum *p, int len);
 void numfree(struct rcsnum *p);
-void text2num(struct rcstext *textp, struct rcsnum *nump);
+int text2num(struct rcstext *textp, struct rcsnum *nump, struct arena *ap);
 
-struct textlist *textsplit(struct rcstext *textp);
+struct textlist *textsplit(struct rcstext *textp, struct arena *ap);
 void textprint(struct rcstext *textp);
 
 #endif
@@ -27,61 +27,179 @@
 
 #include "rcshist.h"
 #include "namedobjlist.h"
+#include "arena.h"
 
-static int nol_hash(Namedobjlist *self, const void *str, int my_len);
-static void nol_rehash(Namedobjlist *self, int log2hs);
-static struct namedobjlist_item *namedobjlist_find(Namedobjlist *self,
-    const void *name, int namelen);
+#define NOL_CHUNK_MIN	128
+#define NOL_CHUNK_MAX	65536
 
+struct nol_chunk {
+	struct nol_chunk *next;
+	size_t used;
+	size_t size;
+};
 
-static int
-nol_hash(Namedobjlist *self, const void *vstr, int my_len) {
-	int hash = 0;
+static unsigned nol_hash(const void *str, long my_len);
+static void nol_rehash(Namedobjlist *self, int log2ns);
+static void nol_compact(Namedobjlist *self);
+static const void *nol_savename(Namedobjlist *self, const void *name,
+    long namelen);
+static int namedobjlist_find(Namedobjlist *self, const void *name,
+    long namelen, unsigned hash);
+
+
+/*
+ * FNV-1a, which unlike a shift-and-add hash spreads out names such as
+ * "1.123" and "1.132" which differ only in the order of their bytes.
+ */
+static unsigned
+nol_hash(const void *vstr, long my_len) {
+	unsigned hash = 2166136261U;
 	const unsigned char *str = vstr;
 	const unsigned char *send = str + my_len;
 
 	while (str < send) {
-		hash += (*str + 1) << ((hash^*str) & 15);
-		str++;
+		hash ^= *str++;
+		hash *= 16777619U;
 	}
 
-	return hash & ((1<<self->log2hashsize) - 1);
+	return hash;
 }
 
+/*
+ * Rebuild the slots, with 1 << log2ns of them.  Removed items are left
+ * out, so this also clears away the holes they leave in the probe chains.
+ */
 static void
-nol_rehash(Namedobjlist *self, int log2hs) {
+nol_rehash(Namedobjlist *self, int log2ns) {
 	struct namedobjlist_item *itemp;
+	unsigned mask = (1U << log2ns) - 1;
 	int i;
 
-	self->log2hashsize = log2hs;
-	self->hash = realloc(self->hash, (size_t)(1<<log2hs) * sizeof(*self->hash));
+	self->log2nslots = log2ns;
+	self->slots = realloc(self->slots, (size_t)(1 << log2ns) *
+	    sizeof(*self->slots));
+
+	for (i = 0; i < (1 << log2ns); i++)
+		self->slots[i].item = -1;
+
+	for (i = self->first; i < self->nused; i++) {
+		unsigned hash, s;
+
+		itemp = &self->items[i];
+		if (itemp->name == NULL)
+			continue;
+		hash = nol_hash(itemp->name, itemp->namelen);
+		for (s = hash & mask; self->slots[s].item >= 0; s = (s + 1) & mask)
+			continue;
+		self->slots[s].hash = hash;
+		self->slots[s].item = i;
+	}
+}
+
+/*
+ * Close up the holes left in items by namedobjlist_removeitem().
+ */
+static void
+nol_compact(Namedobjlist *self) {
+	int i, j;
+
+	for (i = self->first, j = 0; i < self->nused; i++)
+		if (self->items[i].name != NULL)
+			self->items[j++] = self->items[i];
+	self->nused = j;
+	self->first = 0;
+	nol_rehash(self, self->log2nslots);
+}
 
-	for (i = 0; i < (1<<log2hs); i++)
-		TAILQ_INIT(&self->hash[i]);
+static const void *
+nol_savename(Namedobjlist *self, const void *name, long namelen) {
+	struct nol_chunk *chunk = self->names;
+	char *p;
 
-	TAILQ_FOREACH(itemp, &self->all, all) {
-		struct nol_hashhead *hash;
+	if (self->arena != NULL) {
+		p = arena_alloc(self->arena, (size_t)namelen + 1);
+		bcopy(name, p, (size_t)namelen);
+		p[namelen] = '\0';
+		return p;
+	}
 
-		hash = &self->hash[nol_hash(self, itemp->name, itemp->namelen)];
-		TAILQ_INSERT_TAIL(hash, itemp, hash);
+	if (chunk == NULL || chunk->size - chunk->used < (size_t)namelen + 1) {
+		size_t size = (chunk == NULL) ? NOL_CHUNK_MIN : chunk->size * 2;
+
+		if (size > NOL_CHUNK_MAX)
+			size = NOL_CHUNK_MAX;
+		if (size < (size_t)namelen + 1)
+			size = (size_t)namelen + 1;
+		chunk = malloc(sizeof(*chunk) + size);
+		chunk->next = self->names;
+		chunk->used = 0;
+		chunk->size = size;
+		self->names = chunk;
 	}
+
+	p = (char *)(chunk + 1) + chunk->used;
+	bcopy(name, p, (size_t)namelen);
+	p[namelen] = '\0';
+	chunk->used += (size_t)namelen + 1;
+
+	return p;
 }
 
 Namedobjlist *
 namedobjlist_create(void) {
 	Namedobjlist *nol = malloc(sizeof(*nol));
 
-	TAILQ_INIT(&nol->all);
+	nol->items = NULL;
 	nol->nitems = 0;
-	nol->hash = NULL;
+	nol->nused = 0;
+	nol->itemsize = 0;
+	nol->first = 0;
+	nol->slots = NULL;
+	nol->names = NULL;
+	nol->arena = NULL;
 	nol_rehash(nol, 2);
 
 	return nol;
 }
 
+/*
+ * Create a list whose names are kept in ap.  Such a list may be destroyed
+ * while it still has items, since their data is expected to be in the
+ * arena too.
+ */
+Namedobjlist *
+namedobjlist_acreate(struct arena *ap) {
+	Namedobjlist *nol = namedobjlist_create();
+
+	nol->arena = ap;
+	return nol;
+}
+
+/*
+ * Make room for nitems items, so that adding them won't need the table
+ * to be grown and rehashed along the way.
+ */
+void
+namedobjlist_sizehint(Namedobjlist *self, int nitems) {
+	int log2ns;
+
+	if (nitems > self->itemsize) {
+		self->itemsize = nitems;
+		self->items = realloc(self->items, (size_t)self->itemsize *
+		    sizeof(*self->items));
+	}
+
+	for (log2ns = self->log2nslots; (1 << log2ns) < 2 * nitems; log2ns++)
+		continue;
+	if (log2ns != self->log2nslots)
+		nol_rehash(self, log2ns);
+}
+
 void
 namedobjlist_destroy(Namedobjlist *self) {
-	if (self->nitems != 0) {
+	struct nol_chunk *chunk;
+
+	if (self->nitems != 0 && self->arena == NULL) {
 		/*
 		 * Since we know nothing about the list contents, there
 		 * is no way we can figure out how to destroy them.
@@ -89,90 +207,128 @@ namedobjlist_destroy(Namedobjlist *self) {
 		fprintf(stderr, "namedobjlist_destroy: list not empty\n");
 		GIVE_UP();
 	}
-	if (self->hash != NULL)
-		free(self->hash);
+	while ((chunk = self->names) != NULL) {
+		self->names = chunk->next;
+		free(chunk);
+	}
+	free(self->items);
+	free(self->slots);
 	free(self);
 }
 
-static struct namedobjlist_item *
-namedobjlist_find(Namedobjlist *self, const void *name, int namelen) {
+/*
+ * Return the slot for name, or -1 if it isn't in the list.
+ */
+static int
+namedobjlist_find(Namedobjlist *self, const void *name, long namelen,
+    unsigned hash) {
+	struct nol_slot *slot;
 	struct namedobjlist_item *itemp;
-
-	struct nol_hashhead *hash = &self->hash[nol_hash(self, name, namelen)];
-
-	TAILQ_FOREACH(itemp, hash, hash)
-		if (itemp->namelen == namelen && bcmp(name, itemp->name,
-		    (size_t)namelen) == 0)
-			return itemp;
-	return NULL;
+	unsigned mask = (1U << self->log2nslots) - 1;
+	unsigned s;
+
+	for (s = hash & mask; (slot = &self->slots[s])->item >= 0;
+	    s = (s + 1) & mask) {
+		if (slot->hash != hash)
+			continue;
+		itemp = &self->items[slot->item];
+		if (itemp->namelen == namelen && itemp->name != NULL &&
+		    bcmp(name, itemp->name, (size_t)namelen) == 0)
+			return (int)s;
+	}
+	return -1;
 }
 
 void *
-namedobjlist_lookup(Namedobjlist *self, const void *name, int namelen) {
-	struct namedobjlist_item *itemp;
+namedobjlist_lookup(Namedobjlist *self, const void *name, long namelen) {
+	int s;
 
-	itemp = namedobjlist_find(self, name, namelen);
-	return itemp ? itemp->data : NULL;
+	s = namedobjlist_find(self, name, namelen, nol_hash(name, namelen));
+	return (s >= 0) ? self->items[self->slots[s].item].data : NULL;
 }
 
 const void *
-namedobjlist_revlookup(Namedobjlist *self, void *data, int *lenp) {
+namedobjlist_revlookup(Namedobjlist *self, void *data, long *lenp) {
 	struct namedobjlist_item *itemp;
+	int i;
 
-	TAILQ_FOREACH(itemp, &self->all, all)
-		if (data == itemp->data) {
+	for (i = self->first; i < self->nused; i++) {
+		itemp = &self->items[i];
+		if (itemp->name != NULL && data == itemp->data) {
 			if (lenp != NULL)
 				*lenp = itemp->namelen;
 			return itemp->name;
 		}
+	}
 	return NULL;
 }
 
 void
-namedobjlist_additem(Namedobjlist *self, const void *name, int namelen,
+namedobjlist_additem(Namedobjlist *self, const void *name, long namelen,
     void *data) {
 	struct namedobjlist_item *itemp;
-	struct nol_hashhead *hash;
+	unsigned hash, mask;
+	unsigned s;
 
-	if (namedobjlist_find(self, name, namelen) != NULL) {
+	hash = nol_hash(name, namelen);
+	if (namedobjlist_find(self, name, namelen, hash) >= 0) {
 		fprintf(stderr, "namedobjlist_additem: '%.*s' exists!\n",
-		    namelen, (const char *)name); /* XXX strvisx this */
+		    (int)namelen, (const char *)name); /* XXX strvisx this */
 		GIVE_UP();
 	}
 
-	itemp = malloc(sizeof(*itemp));
-	hash = &self->hash[nol_hash(self, name, namelen)];
+	if (self->nused == self->itemsize) {
+		if (self->nitems < self->nused / 2)
+			nol_compact(self);
+		else {
+			self->itemsize += self->itemsize + 4;
+			self->items = realloc(self->items,
+			    (size_t)self->itemsize * sizeof(*self->items));
+		}
+	}
+	if (2 * (self->nused + 1) > (1 << self->log2nslots))
+		nol_rehash(self, self->log2nslots + 1);
 
-	itemp->name = malloc((size_t)namelen + 1);
-	bcopy(name, itemp->name, (size_t)namelen);
-	((char *)itemp->name)[namelen] = '\0';
+	itemp = &self->items[self->nused];
+	itemp->name = nol_savename(self, name, namelen);
 	itemp->namelen = namelen;
 	itemp->data = data;
 
-	TAILQ_INSERT_TAIL(&self->all, itemp, all);
-	TAILQ_INSERT_TAIL(hash, itemp, hash);
-	if (++self->nitems > 2*(1<<self->log2hashsize))
-		nol_rehash(self, self->log2hashsize + 1);
+	mask = (1U << self->log2nslots) - 1;
+	for (s = hash & mask; self->slots[s].item >= 0; s = (s + 1) & mask)
+		continue;
+	self->slots[s].hash = hash;
+	self->slots[s].item = self->nused++;
+	self->nitems++;
 }
 
+/*
+ * The slot is left pointing at the removed item, to keep the probe chains
+ * through it intact; it is only reused after a rehash.
+ */
 void *
-namedobjlist_removeitem(Namedobjlist *self, const void *name, int namelen) {
+namedobjlist_removeitem(Namedobjlist *self, const void *name, long namelen) {
 	struct namedobjlist_item *itemp;
-	struct nol_hashhead *hash;
-	void *ret = NULL;
-
-	itemp = namedobjlist_find(self, name, namelen);
-	hash = &self->hash[nol_hash(self, name, namelen)];
-
-	if (itemp) {
-		ret = itemp->data;
-		TAILQ_REMOVE(&self->all, itemp, all);
-		TAILQ_REMOVE(hash, itemp, hash);
-		free(itemp->name);
-		free(itemp);
-		self->nitems--;
+	int s;
+
+	if ((s = namedobjlist_find(self, name, namelen,
+	    nol_hash(name, namelen))) < 0)
+		return NULL;
+
+	itemp = &self->items[self->slots[s].item];
+	itemp->name = NULL;
+	self->nitems--;
+
+	while (self->first < self->nused &&
+	    self->items[self->first].name == NULL)
+		self->first++;
+	if (self->nitems == 0) {
+		self->nused = 0;
+		self->first = 0;
+		nol_rehash(self, self->log2nslots);
 	}
-	return ret;
+
+	return itemp->data;
 }
 
 Namedobjlist_iter *
@@ -180,28 +336,32 @@ nol_iter_create(Namedobjlist *nol) {
 	Namedobjlist_iter *self = malloc(sizeof(*self));
 
 	self->nol = nol;
-	self->nextitem = TAILQ_FIRST(&nol->all);
+	self->nextitem = nol->first;
 
 	return self;
 }
 
 void
 nol_iter_reset(Namedobjlist_iter *self) {
-	self->nextitem = TAILQ_FIRST(&self->nol->all);
+	self->nextitem = self->nol->first;
 }
 
 void *
-nol_iter_next(Namedobjlist_iter *self, const void **namep, int *namelenp) {
+nol_iter_next(Namedobjlist_iter *self, const void **namep, long *namelenp) {
+	Namedobjlist *nol = self->nol;
 	struct namedobjlist_item *item;
 
-	if ((item = self->nextitem) == NULL)
+	while (self->nextitem < nol->nused &&
+	    nol->items[self->nextitem].name == NULL)
+		self->nextitem++;
+	if (self->nextitem >= nol->nused)
 		return NULL;
 
+	item = &nol->items[self->nextitem++];
 	if (namep != NULL)
 		*namep = item->name;
 	if (namelenp != NULL)
 		*namelenp = item->namelen;
-	self->nextitem = TAILQ_NEXT(item, all);
 
 	return item->data;
 }
@@ -210,4 +370,3 @@ void
 nol_iter_destroy(Namedobjlist_iter *self) {
 	free(self);
 }
-
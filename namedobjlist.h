@@ -27,44 +27,67 @@
 #ifndef NAMEDOBJLIST_H
 #define NAMEDOBJLIST_H
 
-#include "bsd_queue.h"
-
+/*
+ * A hash table of named objects.  The items are kept in an array in the
+ * order they were added, which is the order the iterator returns them,
+ * and slots is an open-addressed (linear probing) index into that array
+ * which also holds each item's hash, so a probe rarely has to look at
+ * the item itself.  The names are copied into chunks which are freed only
+ * with the list, or into an arena given to namedobjlist_acreate(); removing
+ * an item leaves a hole in items until the array is next compacted.
+ */
 typedef struct namedobjlist Namedobjlist;
 
+struct arena;
+
 struct namedobjlist_item {
-	void *name;
-	int namelen;
+	const void *name;		/* NULL if removed */
+	long namelen;
 	void *data;
+};
 
-	TAILQ_ENTRY(namedobjlist_item) all;
-	TAILQ_ENTRY(namedobjlist_item) hash;
+struct nol_slot {
+	unsigned hash;
+	int item;			/* index in items, or -1 if empty */
 };
 
+struct nol_chunk;
+
 struct namedobjlist {
-	TAILQ_HEAD(all_hashhead, namedobjlist_item) all;
-	TAILQ_HEAD(nol_hashhead, namedobjlist_item) *hash;
-	int log2hashsize;
-	int nitems;
+	struct namedobjlist_item *items;
+	int nitems;			/* live items */
+	int nused;			/* items used, including holes */
+	int itemsize;			/* items allocated */
+	int first;			/* no live items before this */
+
+	struct nol_slot *slots;
+	int log2nslots;
+
+	struct nol_chunk *names;
+	struct arena *arena;		/* for names, if not NULL */
 };
 
 typedef struct namedobjlist_iterator Namedobjlist_iter;
 struct namedobjlist_iterator {
 	Namedobjlist *nol;
-	struct namedobjlist_item *nextitem;
+	int nextitem;
 };
 
 Namedobjlist *namedobjlist_create(void);
+Namedobjlist *namedobjlist_acreate(struct arena *ap);
+void namedobjlist_sizehint(Namedobjlist *self, int nitems);
 void namedobjlist_destroy(Namedobjlist *self);
-void *namedobjlist_lookup(Namedobjlist *self, const void *name, int namelen);
-const void *namedobjlist_revlookup(Namedobjlist *self, void *data, int *lenp);
-void namedobjlist_additem(Namedobjlist *self, const void *name, int namelen,
+void *namedobjlist_lookup(Namedobjlist *self, const void *name, long namelen);
+const void *namedobjlist_revlookup(Namedobjlist *self, void *data, long *lenp);
+void namedobjlist_additem(Namedobjlist *self, const void *name, long namelen,
     void *data);
 void *namedobjlist_removeitem(Namedobjlist *self, const void *name,
-    int namelen);
+    long namelen);
 
 Namedobjlist_iter *nol_iter_create(Namedobjlist *nol);
 void nol_iter_reset(Namedobjlist_iter *self);
-void *nol_iter_next(Namedobjlist_iter *self, const void **namep, int *namelenp);
+void *nol_iter_next(Namedobjlist_iter *self, const void **namep,
+    long *namelenp);
 void nol_iter_destroy(Namedobjlist_iter *self);
 
 #endif
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2026 Thomas E. Dickey <dickey@invisible-island.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id: outbuf.c,v 1.1 2026/10/17 12:00:00 tom Exp $
+ */
+
+#include "rcshist.h"
+
+#include <sys/uio.h>
+#include <stdint.h>
+#include <err.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "misc.h"
+#include "outbuf.h"
+
+#define OUT_BUFSIZE	(256 * 1024)
+#define OUT_DIRECT	(OUT_BUFSIZE / 4)	/* not worth copying */
+#define OUT_MEMSIZE	4096			/* to start a memory buffer */
+#define OUT_IOV		64			/* buffers per writev() */
+
+/*
+ * A buffer for stdout, or one which keeps what is written in memory.
+ */
+struct outbuf {
+	char *buf;
+	size_t pos;			/* bytes in buf */
+	size_t size;
+	int tostdout;
+	int interactive;		/* flush each line, as stdio would */
+};
+
+static struct outbuf stdoutbuf = {NULL, 0, 0, 1, 0};
+
+/* Where this thread's output goes */
+static __thread struct outbuf *cur = &stdoutbuf;
+
+static int exiting;			/* flushing from atexit() */
+
+static void out_atexit(void);
+static void out_grow(struct outbuf *ob, size_t len);
+static void out_writev(struct iovec *iov, int n);
+
+struct outbuf *
+outbuf_create(void) {
+	struct outbuf *ob = malloc(sizeof(*ob));
+
+	ob->buf = NULL;
+	ob->pos = 0;
+	ob->size = 0;
+	ob->tostdout = 0;
+	ob->interactive = 0;
+	return ob;
+}
+
+void
+outbuf_free(struct outbuf *ob) {
+	free(ob->buf);
+	free(ob);
+}
+
+/*
+ * Send this thread's output to ob, or to stdout if ob is NULL.
+ */
+void
+out_select(struct outbuf *ob) {
+	cur = (ob != NULL) ? ob : &stdoutbuf;
+}
+
+/*
+ * Write what is in the n memory buffers to stdout, after anything already
+ * buffered there, and empty them.
+ */
+void
+out_emit(struct outbuf **obs, int n) {
+	struct iovec iov[OUT_IOV];
+	int i, j;
+
+	out_flush();
+	for (i = 0; i < n; i += j) {
+		for (j = 0; j < OUT_IOV && i + j < n; j++) {
+			iov[j].iov_base = obs[i + j]->buf;
+			iov[j].iov_len = obs[i + j]->pos;
+			obs[i + j]->pos = 0;
+		}
+		out_writev(iov, j);
+	}
+}
+
+void
+out_write(const char *p, size_t len) {
+	struct outbuf *ob = cur;
+	struct iovec iov[2];
+
+	/* A memory buffer has none until something is written to it */
+	if (len == 0)
+		return;
+	if (len > ob->size - ob->pos) {
+		if (!ob->tostdout)
+			out_grow(ob, len);
+		else if (ob->buf == NULL) {
+			ob->buf = malloc(OUT_BUFSIZE);
+			ob->size = OUT_BUFSIZE;
+			ob->interactive = isatty(STDOUT_FILENO);
+			atexit(out_atexit);
+		}
+	}
+	if (len <= ob->size - ob->pos) {
+		bcopy(p, ob->buf + ob->pos, len);
+		ob->pos += len;
+		if (ob->interactive && p[len - 1] == '\n')
+			out_flush();
+		return;
+	}
+	if (len < OUT_DIRECT) {
+		out_flush();
+		bcopy(p, ob->buf, len);
+		ob->pos = len;
+		return;
+	}
+
+	iov[0].iov_base = ob->buf;
+	iov[0].iov_len = ob->pos;
+	iov[1].iov_base = (void *)(uintptr_t)p;
+	iov[1].iov_len = len;
+	out_writev(iov, 2);
+	ob->pos = 0;
+}
+
+void
+out_char(int c) {
+	struct outbuf *ob = cur;
+
+	if (ob->pos < ob->size && !ob->interactive)
+		ob->buf[ob->pos++] = (char)c;
+	else {
+		char ch = (char)c;
+
+		out_write(&ch, 1);
+	}
+}
+
+void
+out_str(const char *s) {
+	out_write(s, strlen(s));
+}
+
+/*
+ * The first len bytes at p, stopping at a NUL as printf() would, and
+ * padded with spaces to width.
+ */
+void
+out_text(const char *p, int64_t len, int width) {
+	const char *nul;
+
+	if ((nul = memchr(p, '\0', (size_t)len)) != NULL)
+		len = nul - p;
+	out_write(p, (size_t)len);
+	while (len++ < width)
+		out_char(' ');
+}
+
+/*
+ * n in decimal, padded with zeros to width.
+ */
+void
+out_long(long n, int width) {
+	char digits[24];
+	char *p = &digits[sizeof(digits)];
+	unsigned long u;
+
+	u = (n < 0) ? 0 - (unsigned long)n : (unsigned long)n;
+	do {
+		*--p = (char)('0' + u % 10);
+		u /= 10;
+	} while (u != 0);
+	if (n < 0)
+		width--;
+	while (&digits[sizeof(digits)] - p < width)
+		*--p = '0';
+	if (n < 0)
+		*--p = '-';
+	out_write(p, (size_t)(&digits[sizeof(digits)] - p));
+}
+
+void
+out_date(const struct rcsnum *date) {
+	out_long(date->num[0], 0);
+	out_char('/');
+	out_long(date->num[1], 2);
+	out_char('/');
+	out_long(date->num[2], 2);
+	out_char(' ');
+	out_long(date->num[3], 2);
+	out_char(':');
+	out_long(date->num[4], 2);
+	out_char(':');
+	out_long(date->num[5], 2);
+}
+
+void
+out_printf(const char *fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	out_vprintf(fmt, ap);
+	va_end(ap);
+}
+
+void
+out_vprintf(const char *fmt, va_list ap) {
+	char small[256];
+	char *p;
+	va_list ap2;
+	int len;
+
+	va_copy(ap2, ap);
+	len = vsnprintf(small, sizeof(small), fmt, ap);
+	if (len < 0)
+		GIVE_UP();
+	if ((size_t)len < sizeof(small))
+		out_write(small, (size_t)len);
+	else {
+		p = malloc((size_t)len + 1);
+		vsnprintf(p, (size_t)len + 1, fmt, ap2);
+		out_write(p, (size_t)len);
+		free(p);
+	}
+	va_end(ap2);
+}
+
+/*
+ * Write out what is buffered for stdout.
+ */
+void
+out_flush(void) {
+	struct iovec iov;
+
+	if (stdoutbuf.pos == 0)
+		return;
+	iov.iov_base = stdoutbuf.buf;
+	iov.iov_len = stdoutbuf.pos;
+	out_writev(&iov, 1);
+	stdoutbuf.pos = 0;
+}
+
+/*
+ * Flush what is left when exit() is called.  exit() may not be called
+ * again from here, so an error is only reported.
+ */
+static void
+out_atexit(void) {
+	exiting = 1;
+	out_flush();
+}
+
+/*
+ * Make room for len more bytes in the memory buffer ob.
+ */
+static void
+out_grow(struct outbuf *ob, size_t len) {
+	if (ob->size == 0)
+		ob->size = OUT_MEMSIZE;
+	while (len > ob->size - ob->pos)
+		ob->size *= 2;
+	ob->buf = realloc(ob->buf, ob->size);
+}
+
+/*
+ * Write all of iov, however many goes it takes.
+ */
+static void
+out_writev(struct iovec *iov, int n) {
+	ssize_t done;
+
+	while (n > 0) {
+		if ((done = writev(STDOUT_FILENO, iov, n)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (!exiting) {
+				stdoutbuf.pos = 0;	/* for out_atexit() */
+				err(1, "stdout");
+			}
+			if (errno != EPIPE)
+				warn("stdout");
+			_exit(1);
+		}
+		for (; n > 0 && (size_t)done >= iov->iov_len; iov++, n--)
+			done -= (ssize_t)iov->iov_len;
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + done;
+			iov->iov_len -= (size_t)done;
+		}
+	}
+}
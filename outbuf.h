@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2026 Thomas E. Dickey <dickey@invisible-island.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id: outbuf.h,v 1.1 2026/10/17 12:00:00 tom Exp $
+ */
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stdarg.h>
+#include <stdint.h>
+
+/*
+ * Everything shown on the standard output goes through here.  It is
+ * gathered in a large buffer and written with writev(), a long string
+ * being written from where it is rather than copied.  A thread may
+ * instead send its output to a buffer in memory, with out_select(), to
+ * be written later by out_emit().  The formatters
+ * stand in for the printf() conversions the output uses:
+ *
+ * out_text	%.*s, or %-*.*s given a width
+ * out_long	%ld, or %0*ld given a width
+ * out_date	%d/%02d/%02d %02d:%02d:%02d of an RCS date
+ */
+struct rcsnum;
+struct outbuf;
+
+struct outbuf *outbuf_create(void);
+void outbuf_free(struct outbuf *ob);
+void out_select(struct outbuf *ob);
+void out_emit(struct outbuf **obs, int n);
+void out_write(const char *p, size_t len);
+void out_char(int c);
+void out_str(const char *s);
+void out_text(const char *p, int64_t len, int width);
+void out_long(long n, int width);
+void out_date(const struct rcsnum *date);
+void out_printf(const char *fmt, ...);
+void out_vprintf(const char *fmt, va_list ap);
+void out_flush(void);
+
+#endif
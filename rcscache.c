@@ -0,0 +1,545 @@
+/*
+ * Copyright (c) 2026 Thomas E. Dickey <dickey@invisible-island.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id: rcscache.c,v 1.1 2026/10/17 12:00:00 tom Exp $
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#include "rcshist.h"
+#include "rcsfile.h"
+#include "rcscache.h"
+#include "arena.h"
+#include "strbuf.h"
+
+/*
+ * The parse cache holds, for each RCS file, an image of what the parser
+ * found in the admin and delta sections and in the deltatexts read so
+ * far.  An image is only used while the RCS file's device, inode, size,
+ * modification time and status change time are unchanged, to the
+ * nanosecond where the system keeps them, so texts are stored as offsets
+ * into the RCS file rather than copied.  Dates, symbol names and symbol
+ * numbers are kept in pools after the fixed-size records:
+ *
+ *	struct cache_header	header
+ *	struct cache_rev	revs[nrevs]
+ *	struct cache_span	branchrevs[nbranchrevs]
+ *	struct cache_span	access[naccess]
+ *	struct cache_symbol	symbols[nsymbols]
+ *	int32_t			ints[nints]
+ *	char			chars[nchars]
+ *
+ * The image is in native byte order; it is a cache, not an archive.
+ */
+
+#define CACHE_MAGIC	"RCSHIST"
+#define CACHE_VERSION	2
+
+struct cache_span {
+	int64_t off;		/* -1 if the text is not set */
+	int64_t len;
+};
+
+struct cache_header {
+	char magic[8];
+	int32_t version;
+	int32_t textdone;
+	int64_t dev;
+	int64_t ino;
+	int64_t size;
+	int64_t mtime;
+	int64_t mtime_nsec;
+	int64_t ctime;
+	int64_t ctime_nsec;
+	int64_t textpos;	/* where to resume reading deltatexts */
+	int32_t nrevs;
+	int32_t nbranchrevs;
+	int32_t naccess;
+	int32_t nsymbols;
+	int32_t nints;
+	int32_t nchars;
+	struct cache_span headrev;
+	struct cache_span branch;
+	struct cache_span comment;
+	struct cache_span commitid;
+	struct cache_span expand;
+	struct cache_span desc;
+};
+
+struct cache_rev {
+	struct cache_span revtext;
+	struct cache_span author;
+	struct cache_span state;
+	struct cache_span patchnextrev;
+	struct cache_span log;
+	struct cache_span text;
+	int32_t date;		/* index into ints */
+	int32_t datelen;
+	int32_t branchrevs;	/* index into branchrevs */
+	int32_t nbranchrevs;
+};
+
+struct cache_symbol {
+	int32_t name;		/* index into chars */
+	int32_t namelen;
+	int32_t num;		/* index into ints */
+	int32_t numlen;
+};
+
+static char *cachedir;
+static mode_t cachemode;	/* what open() would give with 0644 */
+
+static Strbuf *cache_path(struct rcsfile *rcsp);
+static long cache_textpos(struct rcsfile *rcsp);
+static void span_put(struct cache_span *csp, struct rcsfile *rcsp,
+    struct rcstext *textp);
+static void span_get(struct rcstext *textp, const struct cache_span *csp,
+    struct rcsfile *rcsp);
+static int span_ok(const struct cache_span *csp, struct rcsfile *rcsp);
+static int cache_valid(struct rcsfile *rcsp, const char *map, size_t len);
+static void cache_write(struct rcsfile *rcsp, FILE *fp, long textpos);
+
+void
+rcscache_setdir(const char *dir) {
+	mode_t mask;
+
+	mask = umask(0);
+	umask(mask);
+	cachemode = 0644 & ~mask;
+	if (cachedir != NULL)
+		free(cachedir);
+	cachedir = (dir != NULL) ? strdup(dir) : NULL;
+}
+
+static Strbuf *
+cache_path(struct rcsfile *rcsp) {
+	Strbuf *path = sb_create();
+
+	sb_printf(path, "%s/%lx-%lx", cachedir,
+	    (unsigned long)rcsp->fileid.dev, (unsigned long)rcsp->fileid.ino);
+	return path;
+}
+
+/*
+ * Return the offset at which reading deltatexts would resume, or -1 if
+ * the parser did not stop between two deltatext blocks.
+ */
+static long
+cache_textpos(struct rcsfile *rcsp) {
+	struct parser *pp = &rcsp->textparse;
+
+	if (rcsp->textdone)
+		return (long)rcsp->maplen;
+	if (pp->saved.type == TOKTYPE_NUM)
+		return (long)(pp->saved.value.start - rcsp->mapstart);
+	if (pp->saved.type == TOKTYPE_NONE)
+		return (long)(pp->pos - rcsp->mapstart);
+	return -1;
+}
+
+static void
+span_put(struct cache_span *csp, struct rcsfile *rcsp, struct rcstext *textp) {
+	if (textp->start == NULL) {
+		csp->off = -1;
+		csp->len = 0;
+	} else {
+		csp->off = (int64_t)(textp->start - rcsp->mapstart);
+		csp->len = (int64_t)textp->len;
+	}
+}
+
+static void
+span_get(struct rcstext *textp, const struct cache_span *csp,
+    struct rcsfile *rcsp) {
+	textp->start = (csp->off == -1) ? NULL : rcsp->mapstart + csp->off;
+	textp->len = (long)csp->len;
+}
+
+static int
+span_ok(const struct cache_span *csp, struct rcsfile *rcsp) {
+	if (csp->off == -1)
+		return csp->len == 0;
+	return csp->off >= 0 && csp->len >= 0 &&
+	    (uint64_t)(csp->off + csp->len) <= (uint64_t)rcsp->maplen;
+}
+
+/*
+ * Check that an image belongs to this RCS file, and that every index and
+ * offset in it is in range, before anything is built from it.
+ */
+static int
+cache_valid(struct rcsfile *rcsp, const char *map, size_t len) {
+	const struct cache_header *hdr;
+	const struct cache_rev *crev;
+	const struct cache_span *cspan;
+	const struct cache_symbol *csym;
+	uint64_t want;
+	int32_t i;
+
+	if (len < sizeof(*hdr))
+		return 0;
+	hdr = (const struct cache_header *)(const void *)map;
+	if (memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    hdr->version != CACHE_VERSION ||
+	    hdr->dev != (int64_t)rcsp->fileid.dev ||
+	    hdr->ino != (int64_t)rcsp->fileid.ino ||
+	    hdr->size != (int64_t)rcsp->fileid.size ||
+	    hdr->mtime != (int64_t)rcsp->fileid.mtime ||
+	    hdr->mtime_nsec != (int64_t)rcsp->fileid.mtime_nsec ||
+	    hdr->ctime != (int64_t)rcsp->fileid.ctime ||
+	    hdr->ctime_nsec != (int64_t)rcsp->fileid.ctime_nsec)
+		return 0;
+	if (hdr->nrevs < 0 || hdr->nbranchrevs < 0 || hdr->naccess < 0 ||
+	    hdr->nsymbols < 0 || hdr->nints < 0 || hdr->nchars < 0 ||
+	    hdr->textpos < 0 || (uint64_t)hdr->textpos > rcsp->maplen)
+		return 0;
+
+	want = sizeof(*hdr) +
+	    (uint64_t)hdr->nrevs * sizeof(*crev) +
+	    (uint64_t)(hdr->nbranchrevs + hdr->naccess) * sizeof(*cspan) +
+	    (uint64_t)hdr->nsymbols * sizeof(*csym) +
+	    (uint64_t)hdr->nints * sizeof(int32_t) +
+	    (uint64_t)hdr->nchars;
+	if (want != len)
+		return 0;
+
+	if (!span_ok(&hdr->headrev, rcsp) || !span_ok(&hdr->branch, rcsp) ||
+	    !span_ok(&hdr->comment, rcsp) || !span_ok(&hdr->commitid, rcsp) ||
+	    !span_ok(&hdr->expand, rcsp) || !span_ok(&hdr->desc, rcsp))
+		return 0;
+
+	crev = (const struct cache_rev *)(const void *)(hdr + 1);
+	for (i = 0; i < hdr->nrevs; i++, crev++) {
+		if (!span_ok(&crev->revtext, rcsp) ||
+		    crev->revtext.off == -1 ||
+		    !span_ok(&crev->author, rcsp) ||
+		    !span_ok(&crev->state, rcsp) ||
+		    !span_ok(&crev->patchnextrev, rcsp) ||
+		    !span_ok(&crev->log, rcsp) ||
+		    !span_ok(&crev->text, rcsp))
+			return 0;
+		if (crev->date < 0 || crev->datelen < 0 ||
+		    crev->date > hdr->nints - crev->datelen)
+			return 0;
+		if (crev->branchrevs < 0 || crev->nbranchrevs < 0 ||
+		    crev->branchrevs > hdr->nbranchrevs - crev->nbranchrevs)
+			return 0;
+	}
+
+	cspan = (const struct cache_span *)(const void *)crev;
+	for (i = 0; i < hdr->nbranchrevs + hdr->naccess; i++, cspan++)
+		if (!span_ok(cspan, rcsp) || cspan->off == -1)
+			return 0;
+
+	csym = (const struct cache_symbol *)(const void *)cspan;
+	for (i = 0; i < hdr->nsymbols; i++, csym++) {
+		if (csym->name < 0 || csym->namelen < 0 ||
+		    csym->name > hdr->nchars - csym->namelen)
+			return 0;
+		if (csym->num < 0 || csym->numlen < 1 ||
+		    csym->num > hdr->nints - csym->numlen)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Load the parse state of rcsp from its cache image, if there is a valid
+ * one.  Returns 0 if the file must be parsed instead.
+ */
+int
+rcscache_load(struct rcsfile *rcsp) {
+	const struct cache_header *hdr;
+	const struct cache_rev *crev;
+	const struct cache_span *branchrevs, *access;
+	const struct cache_symbol *csym;
+	const int32_t *ints;
+	const char *chars;
+	struct revnode *revp;
+	struct revinfo *rip;
+	struct rcsnum *nump;
+	struct rcstext text;
+	struct stat sb;
+	Strbuf *path;
+	char *map;
+	int fd;
+	int32_t i, j;
+
+	if (cachedir == NULL)
+		return 0;
+
+	path = cache_path(rcsp);
+	fd = open(sb_ptr(path), O_RDONLY);
+	sb_free(path);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &sb) != 0 || sb.st_size == 0 ||
+	    (map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd,
+	    0)) == MAP_FAILED) {
+		close(fd);
+		return 0;
+	}
+	close(fd);
+
+	if (!cache_valid(rcsp, map, (size_t)sb.st_size)) {
+		munmap(map, (size_t)sb.st_size);
+		return 0;
+	}
+
+	hdr = (const struct cache_header *)(const void *)map;
+	crev = (const struct cache_rev *)(const void *)(hdr + 1);
+	branchrevs = (const struct cache_span *)(const void *)
+	    (crev + hdr->nrevs);
+	access = branchrevs + hdr->nbranchrevs;
+	csym = (const struct cache_symbol *)(const void *)
+	    (access + hdr->naccess);
+	ints = (const int32_t *)(const void *)(csym + hdr->nsymbols);
+	chars = (const char *)(ints + hdr->nints);
+
+	namedobjlist_sizehint(rcsp->symbols, hdr->nsymbols);
+	namedobjlist_sizehint(rcsp->revs, hdr->nrevs);
+	namedobjlist_sizehint(rcsp->revsbynum, hdr->nrevs);
+
+	span_get(&rcsp->headrev, &hdr->headrev, rcsp);
+	span_get(&rcsp->branch, &hdr->branch, rcsp);
+	span_get(&rcsp->comment, &hdr->comment, rcsp);
+	span_get(&rcsp->commitid, &hdr->commitid, rcsp);
+	span_get(&rcsp->expand, &hdr->expand, rcsp);
+	span_get(&rcsp->desc, &hdr->desc, rcsp);
+
+	for (i = 0; i < hdr->naccess; i++) {
+		span_get(&text, &access[i], rcsp);
+		textlist_add(rcsp->access, &text);
+	}
+
+	for (i = 0; i < hdr->nsymbols; i++, csym++) {
+		nump = arena_alloc(rcsp->arena, sizeof(*nump));
+		numalloc(nump, csym->numlen, rcsp->arena);
+		for (j = 0; j < nump->len; j++)
+			nump->num[j] = ints[csym->num + j];
+		namedobjlist_additem(rcsp->symbols, chars + csym->name,
+		    csym->namelen, nump);
+	}
+
+	for (i = 0; i < hdr->nrevs; i++, crev++) {
+		span_get(&text, &crev->revtext, rcsp);
+		revp = rev_create(rcsp, &text);
+		rip = revp->info;
+		span_get(&rip->author, &crev->author, rcsp);
+		span_get(&rip->state, &crev->state, rcsp);
+		span_get(&rip->patchnextrev, &crev->patchnextrev, rcsp);
+		span_get(&rip->log, &crev->log, rcsp);
+		span_get(&rip->text, &crev->text, rcsp);
+
+		if (crev->datelen > 0) {
+			numalloc(&rip->date, crev->datelen, rcsp->arena);
+			for (j = 0; j < rip->date.len; j++)
+				rip->date.num[j] = ints[crev->date + j];
+		}
+
+		for (j = 0; j < crev->nbranchrevs; j++) {
+			span_get(&text, &branchrevs[crev->branchrevs + j], rcsp);
+			textlist_add(rip->branchrevs, &text);
+		}
+	}
+
+	rcsp->textparse.pos = rcsp->mapstart + hdr->textpos;
+	rcsp->textdone = hdr->textdone;
+	rcsp->cachepos = (long)hdr->textpos;
+
+	munmap(map, (size_t)sb.st_size);
+	return 1;
+}
+
+static void
+cache_write(struct rcsfile *rcsp, FILE *fp, long textpos) {
+	struct cache_header hdr;
+	struct cache_rev crev;
+	struct cache_span cspan;
+	struct cache_symbol csym;
+	Namedobjlist_iter *iter;
+	struct revnode *revp;
+	struct revinfo *rip;
+	struct rcsnum *nump;
+	struct rcstext *textp;
+	const void *name;
+	long namelen;
+	int32_t n, nbr;
+	int i, r;
+
+	bzero(&hdr, sizeof(hdr));
+	memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version = CACHE_VERSION;
+	hdr.textdone = rcsp->textdone;
+	hdr.dev = (int64_t)rcsp->fileid.dev;
+	hdr.ino = (int64_t)rcsp->fileid.ino;
+	hdr.size = (int64_t)rcsp->fileid.size;
+	hdr.mtime = (int64_t)rcsp->fileid.mtime;
+	hdr.mtime_nsec = (int64_t)rcsp->fileid.mtime_nsec;
+	hdr.ctime = (int64_t)rcsp->fileid.ctime;
+	hdr.ctime_nsec = (int64_t)rcsp->fileid.ctime_nsec;
+	hdr.textpos = textpos;
+	hdr.nrevs = rcsp->nrevs;
+	hdr.naccess = (int32_t)rcsp->access->len;
+	span_put(&hdr.headrev, rcsp, &rcsp->headrev);
+	span_put(&hdr.branch, rcsp, &rcsp->branch);
+	span_put(&hdr.comment, rcsp, &rcsp->comment);
+	span_put(&hdr.commitid, rcsp, &rcsp->commitid);
+	span_put(&hdr.expand, rcsp, &rcsp->expand);
+	span_put(&hdr.desc, rcsp, &rcsp->desc);
+
+	for (r = 0; r < rcsp->nrevs; r++) {
+		revp = REVNODE(rcsp, r);
+		hdr.nbranchrevs += (int32_t)revp->info->branchrevs->len;
+		hdr.nints += revp->info->date.len;
+	}
+
+	iter = nol_iter_create(rcsp->symbols);
+	while ((nump = nol_iter_next(iter, NULL, &namelen)) != NULL) {
+		hdr.nsymbols++;
+		hdr.nints += nump->len;
+		hdr.nchars += (int32_t)namelen;
+	}
+	nol_iter_destroy(iter);
+
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+
+	/* Dates come first in the ints pool, then symbol numbers */
+	n = 0;
+	nbr = 0;
+	for (r = 0; r < rcsp->nrevs; r++) {
+		revp = REVNODE(rcsp, r);
+		rip = revp->info;
+		span_put(&crev.revtext, rcsp, &rip->revtext);
+		span_put(&crev.author, rcsp, &rip->author);
+		span_put(&crev.state, rcsp, &rip->state);
+		span_put(&crev.patchnextrev, rcsp, &rip->patchnextrev);
+		span_put(&crev.log, rcsp, &rip->log);
+		span_put(&crev.text, rcsp, &rip->text);
+		crev.date = n;
+		crev.datelen = rip->date.len;
+		crev.branchrevs = nbr;
+		crev.nbranchrevs = (int32_t)rip->branchrevs->len;
+		fwrite(&crev, sizeof(crev), 1, fp);
+		n += crev.datelen;
+		nbr += crev.nbranchrevs;
+	}
+
+	for (r = 0; r < rcsp->nrevs; r++) {
+		TEXTLIST_FOREACH(REVNODE(rcsp, r)->info->branchrevs, textp) {
+			span_put(&cspan, rcsp, textp);
+			fwrite(&cspan, sizeof(cspan), 1, fp);
+		}
+	}
+
+	TEXTLIST_FOREACH(rcsp->access, textp) {
+		span_put(&cspan, rcsp, textp);
+		fwrite(&cspan, sizeof(cspan), 1, fp);
+	}
+
+	csym.name = 0;
+	csym.num = n;
+	iter = nol_iter_create(rcsp->symbols);
+	while ((nump = nol_iter_next(iter, NULL, &namelen)) != NULL) {
+		csym.namelen = (int32_t)namelen;
+		csym.numlen = nump->len;
+		fwrite(&csym, sizeof(csym), 1, fp);
+		csym.name += csym.namelen;
+		csym.num += csym.numlen;
+	}
+	nol_iter_destroy(iter);
+
+	for (r = 0; r < rcsp->nrevs; r++) {
+		revp = REVNODE(rcsp, r);
+		for (i = 0; i < revp->info->date.len; i++) {
+			n = revp->info->date.num[i];
+			fwrite(&n, sizeof(n), 1, fp);
+		}
+	}
+
+	iter = nol_iter_create(rcsp->symbols);
+	while ((nump = nol_iter_next(iter, NULL, NULL)) != NULL) {
+		for (i = 0; i < nump->len; i++) {
+			n = nump->num[i];
+			fwrite(&n, sizeof(n), 1, fp);
+		}
+	}
+
+	nol_iter_reset(iter);
+	while (nol_iter_next(iter, &name, &namelen) != NULL)
+		fwrite(name, (size_t)namelen, 1, fp);
+	nol_iter_destroy(iter);
+}
+
+/*
+ * Write the cache image for rcsp, if caching is enabled and more of the
+ * file has been parsed than its current image records.  The image is
+ * written under a unique temporary name and renamed, so that concurrent
+ * readers see either the old image or the new one, and so that threads
+ * saving the same file under two names do not share the temporary.
+ */
+void
+rcscache_save(struct rcsfile *rcsp) {
+	Strbuf *path, *tmp;
+	FILE *fp;
+	long textpos;
+	int fd;
+
+	if (cachedir == NULL)
+		return;
+	if ((textpos = cache_textpos(rcsp)) <= rcsp->cachepos)
+		return;
+
+	path = cache_path(rcsp);
+	tmp = sb_create();
+	sb_printf(tmp, "%s.XXXXXX", sb_ptr(path));
+
+	if ((fd = mkstemp(sb_ptr(tmp))) < 0 || fchmod(fd, cachemode) != 0 ||
+	    (fp = fdopen(fd, "w")) == NULL) {
+		warn("%s", sb_ptr(tmp));
+		if (fd >= 0) {
+			close(fd);
+			unlink(sb_ptr(tmp));
+		}
+	} else {
+		cache_write(rcsp, fp, textpos);
+		if (ferror(fp) | (fclose(fp) != 0)) {
+			warn("%s", sb_ptr(tmp));
+			unlink(sb_ptr(tmp));
+		} else if (rename(sb_ptr(tmp), sb_ptr(path)) != 0) {
+			warn("%s", sb_ptr(path));
+			unlink(sb_ptr(tmp));
+		} else
+			rcsp->cachepos = textpos;
+	}
+
+	sb_free(path);
+	sb_free(tmp);
+}
@@ -29,88 +29,259 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
 #include <err.h>
+#include <limits.h>
 
 #include "rcshist.h"
 #include "rcsfile.h"
-#include "strbuf.h"
+#include "rcscache.h"
+#include "arena.h"
+#include "textcache.h"
+#include "outbuf.h"
 
 static void get_admin(struct parser *pp, struct rcsfile *rcsp);
 static void get_deltas(struct parser *pp, struct rcsfile *rcsp);
 static void get_desc(struct parser *pp, struct rcsfile *rcsp);
-static void get_deltatexts(struct parser *pp, struct rcsfile *rcsp);
+static void get_deltatexts(struct rcsfile *rcsp, struct revnode *want);
+static void rev_filter(struct revnode *revp);
 static void fixup_deltas(struct rcsfile *rcsp);
-static void patch_printop(struct rcspatch_op *opp, const char *prefix);
+static uint64_t datekey(const struct rcsnum *date);
+static void patch_printname(struct revnode *rp);
+static void patch_printop(struct rcspatch_op *opp, long from, long to,
+    const char *prefix);
 static void reversepatch(struct rcspatch *pp);
 static struct rcspatch *makepatch(struct revnode *revp);
+static void rev_build(struct revnode *revp);
+static void rev_loadscript(struct revnode *revp);
+static void delta_count(struct revnode *revp, long *addp, long *delp);
+static long rev_nlines(struct revnode *revp);
+static long edcmd_parse(struct rcstext *textp, struct rcstext *end,
+    struct edcmd *ecp);
+static struct rcspatch *patch_build(struct revnode *revp,
+    struct piecetable *plist);
+static void patch_print(struct rcspatch *pp, struct revnode *revp, int ctx,
+    int reverse);
+static void stream_moveto(struct revstream *rsp, long pos);
 static struct rcspatch *patch_create(void);
+static void patch_toobig(struct revnode *revp) GCC_NORETURN;
 static void patch_destroy(struct rcspatch *pp);
-static void patch_add(struct rcspatch *pp, int op, int line, int nline,
-    int len, struct rcstext *textp);
+static void patch_add(struct rcspatch *pp, int op, long line, long nline,
+    long len, struct rcstext *textp, const struct piecepos *pos);
 static int id_lookup(struct rcstext *id);
 static int optional_tok(struct parser *pp, struct token *tokp, int type);
 static void expect_tok(struct parser *pp, struct token *tokp, int type);
 static void puttok(struct parser *pp, struct token *tokp);
 static int gettok(struct parser *pp, struct token *tokp);
+static void diag_printf(struct rcsdiag *diag, const char *fmt, ...);
+static void diag_warn(struct rcsdiag *diag, const char *fmt, ...);
+static void diag_warnx(struct rcsdiag *diag, const char *fmt, ...);
+static void diag_fatal(struct rcsdiag *diag, const char *fmt, ...)
+    GCC_NORETURN;
 
 static const char *tokname[] = {"NONE", "NUM", "ID", "STRING", "COLON", "SEMI"};
 
-static struct rcstext
-	id_desc =	{"desc",	4},
-	id_head =	{"head",	4},
-	id_branch =	{"branch",	6},
-	id_access =	{"access",	6},
-	id_symbols =	{"symbols",	7},
-	id_locks =	{"locks",	5},
-	id_strict =	{"strict",	6},
-	id_comment =	{"comment",	7},
-	id_expand =	{"expand",	6},
-	id_date =	{"date",	4},
-	id_author =	{"author",	6},
-	id_state =	{"state",	5},
-	id_branches =	{"branches",	8},
-	id_next =	{"next",	4},
-	id_commitid =	{"commitid",	8},
-	id_log =	{"log",		3},
-	id_text =	{"text",	4};
+
+/*
+ * The keywords, placed by KEYWORD_HASH(), which gives each of them a
+ * different slot.  Check that it still does if one is added.
+ */
+#define KEYWORD_HASH(p, len) \
+	(((len) + 3 * (p)[0] + 17 * (p)[1]) & 31)
+#define KEYWORD_MINLEN	3
+#define KEYWORD_MAXLEN	8
+
+static const struct keyword {
+	struct rcstext name;
+	int id;
+} keywords[32] = {
+	{{"branches",	8},	ID_BRANCHES},
+	{{"date",	4},	ID_DATE},
+	{{NULL,		0},	ID_NONE},
+	{{"next",	4},	ID_NEXT},
+	{{NULL,		0},	ID_NONE},
+	{{"desc",	4},	ID_DESC},
+	{{"log",	3},	ID_LOG},
+	{{NULL,		0},	ID_NONE},
+	{{"locks",	5},	ID_LOCKS},
+	{{"symbols",	7},	ID_SYMBOLS},
+	{{NULL,		0},	ID_NONE},
+	{{NULL,		0},	ID_NONE},
+	{{NULL,		0},	ID_NONE},
+	{{"expand",	6},	ID_EXPAND},
+	{{"author",	6},	ID_AUTHOR},
+	{{"comment",	7},	ID_COMMENT},
+	{{"commitid",	8},	ID_COMMITID},
+	{{"head",	4},	ID_HEAD},
+	{{"state",	5},	ID_STATE},
+	{{"strict",	6},	ID_STRICT},
+	{{NULL,		0},	ID_NONE},
+	{{"text",	4},	ID_TEXT},
+	{{NULL,		0},	ID_NONE},
+	{{NULL,		0},	ID_NONE},
+	{{NULL,		0},	ID_NONE},
+	{{NULL,		0},	ID_NONE},
+	{{NULL,		0},	ID_NONE},
+	{{NULL,		0},	ID_NONE},
+	{{"access",	6},	ID_ACCESS},
+	{{NULL,		0},	ID_NONE},
+	{{"branch",	6},	ID_BRANCH},
+	{{NULL,		0},	ID_NONE},
+};
+
+/*
+ * Each phrase is parsed by a handler picked from a table indexed by the
+ * ID_* value of its keyword.  keyp is the keyword token.  The admin and
+ * delta handlers also read the ';' ending the phrase.
+ */
+typedef void phrase_handler(struct parser *pp, struct rcsfile *rcsp,
+    struct revnode *revp, struct token *keyp);
+
+static phrase_handler admin_head, admin_branch, admin_access, admin_symbols,
+    admin_locks, admin_comment, admin_commitid, admin_expand, admin_unknown;
+static phrase_handler delta_date, delta_author, delta_state, delta_branches,
+    delta_next, delta_commitid, delta_unknown;
+static phrase_handler text_log, text_text, text_unknown;
+static void skip_phrase(struct parser *pp, struct rcsfile *rcsp,
+    const char *section, struct token *keyp);
+
+static phrase_handler *const admin_phrases[ID_MAX] = {
+	admin_unknown,		/* ID_NONE */
+	NULL,			/* ID_DESC */
+	admin_head,
+	admin_branch,
+	admin_access,
+	admin_symbols,
+	admin_locks,
+	admin_unknown,		/* ID_STRICT */
+	admin_comment,
+	admin_expand,
+	admin_unknown,		/* ID_DATE */
+	admin_unknown,		/* ID_AUTHOR */
+	admin_unknown,		/* ID_STATE */
+	admin_unknown,		/* ID_BRANCHES */
+	admin_unknown,		/* ID_NEXT */
+	admin_unknown,		/* ID_LOG */
+	admin_unknown,		/* ID_TEXT */
+	admin_commitid,
+};
+
+static phrase_handler *const delta_phrases[ID_MAX] = {
+	delta_unknown,		/* ID_NONE */
+	NULL,			/* ID_DESC */
+	delta_unknown,		/* ID_HEAD */
+	delta_unknown,		/* ID_BRANCH */
+	delta_unknown,		/* ID_ACCESS */
+	delta_unknown,		/* ID_SYMBOLS */
+	delta_unknown,		/* ID_LOCKS */
+	delta_unknown,		/* ID_STRICT */
+	delta_unknown,		/* ID_COMMENT */
+	delta_unknown,		/* ID_EXPAND */
+	delta_date,
+	delta_author,
+	delta_state,
+	delta_branches,
+	delta_next,
+	delta_unknown,		/* ID_LOG */
+	delta_unknown,		/* ID_TEXT */
+	delta_commitid,
+};
+
+static phrase_handler *const text_phrases[ID_MAX] = {
+	text_unknown,		/* ID_NONE */
+	text_unknown,		/* ID_DESC */
+	text_unknown,		/* ID_HEAD */
+	text_unknown,		/* ID_BRANCH */
+	text_unknown,		/* ID_ACCESS */
+	text_unknown,		/* ID_SYMBOLS */
+	text_unknown,		/* ID_LOCKS */
+	text_unknown,		/* ID_STRICT */
+	text_unknown,		/* ID_COMMENT */
+	text_unknown,		/* ID_EXPAND */
+	text_unknown,		/* ID_DATE */
+	text_unknown,		/* ID_AUTHOR */
+	text_unknown,		/* ID_STATE */
+	text_unknown,		/* ID_BRANCHES */
+	text_unknown,		/* ID_NEXT */
+	text_log,
+	text_text,
+	text_unknown,		/* ID_COMMITID */
+};
 
 
 struct rcsfile *
 rcsfile_open(const char *filename) {
+	return rcsfile_opendiag(filename, 0, NULL, NULL);
+}
+
+/*
+ * Open an RCS file.  With RCSFILE_NOTEXT, only the admin, delta and desc
+ * sections and the log strings are used; rev_calc() and rev_diff() must
+ * not be called.
+ */
+struct rcsfile *
+rcsfile_openflags(const char *filename, int flags) {
+	return rcsfile_opendiag(filename, flags, NULL, NULL);
+}
+
+/*
+ * Like rcsfile_openflags, but leaving out of revlist() what filter does,
+ * and counting the revisions left in rcsp->nshown.  If diag is not NULL
+ * the messages are saved in it and a fatal error longjmps to diag->env,
+ * which the caller must have set up.  Nothing here touches global state,
+ * so different files may be opened in different threads.  rcsp->diag is
+ * also used by revlist(); clear it before handing the file to code which
+ * may print.
+ */
+struct rcsfile *
+rcsfile_opendiag(const char *filename, int flags,
+    const struct rcsfilter *filter, struct rcsdiag *diag) {
 	int fd;
 	struct stat sb;
-	struct parser pp;
-	struct token tok;
+	struct parser *pp;
 	struct rcsfile *rcsp;
 	char *map, *p;
+	int i;
 
 	if ((fd = open(filename, O_RDONLY)) < 0) {
-		warn("%s: open", filename);
+		diag_warn(diag, "%s: open", filename);
 		return NULL;
 	}
 
 	if (fstat(fd, &sb) != 0) {
-		warn("%s: fstat", filename);
+		diag_warn(diag, "%s: fstat", filename);
+		close(fd);
+		return NULL;
+	}
+
+	if ((off_t)(size_t)sb.st_size != sb.st_size) {
+		diag_warnx(diag, "%s: too large to map", filename);
 		close(fd);
 		return NULL;
 	}
 
 	if ((map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) ==
 	    MAP_FAILED) {
-		warn("%s: mmap", filename);
+		diag_warn(diag, "%s: mmap", filename);
 		close(fd);
 		return NULL;
 	}
 
 	close(fd);
 
-	pp.pos = map;
-	pp.end = map + sb.st_size;
-	pp.saved.type = TOKTYPE_NONE;
-
 	rcsp = calloc(1, sizeof(*rcsp));
+	rcsp->diag = diag;
+
+	pp = &rcsp->textparse;
+	pp->pos = map;
+	pp->end = map + sb.st_size;
+	pp->scan = scan_select();
+	pp->rcsp = rcsp;
+	pp->saved.type = TOKTYPE_NONE;
+
 	rcsp->mapstart = map;
-	rcsp->maplen = (int)sb.st_size;
+	rcsp->maplen = (size_t)sb.st_size;
 	rcsp->filename = strdup(filename);
 
 	p = strrchr(rcsp->filename, '/');
@@ -120,92 +291,76 @@ rcsfile_open(const char *filename) {
 	    rcsp->shortfname.len - 2, 2) == 0)
 		rcsp->shortfname.len -= 2;
 
-	rcsp->flags = 0;
-
-	rcsp->access = textlist_create();
-	rcsp->symbols = namedobjlist_create();
-	rcsp->revtags = namedobjlist_create();
-	rcsp->branchhead = namedobjlist_create();
-	rcsp->revs = namedobjlist_create();
-	rcsp->revsbynum = namedobjlist_create();
-
-	get_admin(&pp, rcsp);
-	get_deltas(&pp, rcsp);
-	get_desc(&pp, rcsp);
-	get_deltatexts(&pp, rcsp);
+	rcsp->flags = flags;
+	rcsp->filter = filter;
+
+	rcsp->arena = arena_create();
+	rcsp->access = textlist_acreate(rcsp->arena);
+	rcsp->symbols = namedobjlist_acreate(rcsp->arena);
+	rcsp->revtags = namedobjlist_acreate(rcsp->arena);
+	rcsp->branchhead = namedobjlist_acreate(rcsp->arena);
+	rcsp->branches = namedobjlist_acreate(rcsp->arena);
+	rcsp->revs = namedobjlist_acreate(rcsp->arena);
+	rcsp->revsbynum = namedobjlist_acreate(rcsp->arena);
+
+	rcsp->fileid.dev = sb.st_dev;
+	rcsp->fileid.ino = sb.st_ino;
+	rcsp->fileid.size = sb.st_size;
+	rcsp->fileid.mtime = sb.st_mtime;
+	rcsp->fileid.ctime = sb.st_ctime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	rcsp->fileid.mtime_nsec = sb.st_mtim.tv_nsec;
+	rcsp->fileid.ctime_nsec = sb.st_ctim.tv_nsec;
+#endif
+	rcsp->cachepos = -1;
+
+	if (!rcscache_load(rcsp)) {
+		get_admin(pp, rcsp);
+		get_deltas(pp, rcsp);
+		get_desc(pp, rcsp);
+		rcsp->textdone = 0;
+	} else
+		for (i = 0; i < rcsp->nrevs; i++)
+			rev_filter(REVNODE(rcsp, i));
 	fixup_deltas(rcsp);
-	if (gettok(&pp, &tok))
-		errx(1, "%s: junk at end of rcs file", filename);
 
 	return rcsp;
 }
 
+/*
+ * Almost everything built while parsing is in rcsp->arena, and goes with
+ * it.  Only the output lines of RCSFILE_LOWMEM or the text cache, which
+ * are freed as they go, come from malloc, and they are looked for only if
+ * some are left.
+ */
 void
 rcsfile_free(struct rcsfile *rcsp) {
-	Namedobjlist_iter *iter;
-	struct revnode *revp;
-	struct rcsnum *nump;
-	struct textlist *tlp;
-	const void *name;
-	int namelen;
-
-	iter = nol_iter_create(rcsp->revs);
-	while ((revp = nol_iter_next(iter, &name, &namelen)) != NULL) {
-		namedobjlist_removeitem(rcsp->revs, name, namelen);
-		namedobjlist_removeitem(rcsp->revsbynum, revp->rev.num,
-		    RCSNUM_BYTES(&revp->rev));
-
-		numfree(&revp->rev);
-		numfree(&revp->date);
-		if (revp->textlines != NULL)
-			textlist_destroy(revp->textlines);
-		if (revp->outputlines != NULL)
-			textlist_destroy(revp->outputlines);
-		textlist_destroy(revp->branchrevs);
-		textlist_destroy(revp->branchpoints);
-		textlist_destroy(revp->branches);
-		textlist_destroy(revp->tags);
-		free(revp);
-
-		nol_iter_reset(iter);
-	}
-	nol_iter_destroy(iter);
-
-	iter = nol_iter_create(rcsp->symbols);
-	while ((nump = nol_iter_next(iter, &name, &namelen)) != NULL) {
-		namedobjlist_removeitem(rcsp->symbols, name, namelen);
-		numfree(nump);
-		free(nump);
-
-		nol_iter_reset(iter);
-	}
-	nol_iter_destroy(iter);
-
-	iter = nol_iter_create(rcsp->revtags);
-	while ((tlp = nol_iter_next(iter, &name, &namelen)) != NULL) {
-		namedobjlist_removeitem(rcsp->revtags, name, namelen);
-		textlist_destroy(tlp);
-
-		nol_iter_reset(iter);
-	}
-	nol_iter_destroy(iter);
+	struct revinfo *rip;
+	int i;
 
-	iter = nol_iter_create(rcsp->branchhead);
-	while ((revp = nol_iter_next(iter, &name, &namelen)) != NULL) {
-		namedobjlist_removeitem(rcsp->branchhead, name, namelen);
+	rcscache_save(rcsp);
 
-		nol_iter_reset(iter);
+	for (i = 0; rcsp->nheaplines != 0 && i < rcsp->nrevs; i++) {
+		rip = REVNODE(rcsp, i)->info;
+		if (rip->outputlines != NULL &&
+		    rip->outputlines->arena == NULL) {
+			textcache_remove(REVNODE(rcsp, i));
+			pt_destroy(rip->outputlines);
+			rcsp->nheaplines--;
+		}
 	}
-	nol_iter_destroy(iter);
 
-	textlist_destroy(rcsp->access);
 	namedobjlist_destroy(rcsp->symbols);
 	namedobjlist_destroy(rcsp->revtags);
 	namedobjlist_destroy(rcsp->branchhead);
+	namedobjlist_destroy(rcsp->branches);
 	namedobjlist_destroy(rcsp->revs);
 	namedobjlist_destroy(rcsp->revsbynum);
+	arena_destroy(rcsp->arena);
+	free(rcsp->revblk);
+	free(rcsp->infoblk);
 
-	if (munmap(rcsp->mapstart, (size_t)rcsp->maplen) != 0)
+	if (munmap(rcsp->mapstart, rcsp->maplen) != 0)
 		warn("rcsfile_free: munmap");
 	free(rcsp->filename);
 
@@ -217,16 +372,31 @@ rcsfile_free(struct rcsfile *rcsp) {
  * given one.
  */
 struct rcsfile *
-rcsfile_smartopen(const char *filename, char **branchp) {
+rcsfile_smartopen(const char *filename, char **branchp, int flags) {
+	struct rcsfile *rcsp;
+	char *path;
+
+	path = rcsfile_findpath(filename, branchp);
+	rcsp = rcsfile_openflags(path, flags);
+	free(path);
+
+	return rcsp;
+}
+
+/*
+ * Return the name of the ,v file for filename, in malloc'd memory.  If
+ * *branchp is NULL and there is a CVS directory, it is set from CVS/Tag.
+ */
+char *
+rcsfile_findpath(const char *filename, char **branchp) {
 	Strbuf *base_name, *dirname, *rcsdir, *ftmp, *buf;
 	int len, dlen;
 	FILE *fp;
 	char *p;
-	struct rcsfile *rcsp;
 
 	len = (int)strlen(filename);
 	if (len > 2 && strcmp(filename + len - 2, ",v") == 0)
-		return rcsfile_open(filename);
+		return strdup(filename);
 
 	base_name = sb_create();
 	dirname = sb_create();
@@ -296,15 +466,13 @@ rcsfile_smartopen(const char *filename, char **branchp) {
 		}
 	}
 
-	rcsp = rcsfile_open(sb_ptr(ftmp));
-
 	sb_free(base_name);
 	sb_free(dirname);
 	sb_free(rcsdir);
-	sb_free(ftmp);
+	p = sb_detach(ftmp);
 	sb_free(buf);
 
-	return rcsp;
+	return p;
 }
 
 void
@@ -313,6 +481,62 @@ rcsfile_setflags(struct rcsfile *rcsp, int flags) {
 }
 
 
+/*
+ * Create the node for a revision listed in the delta section.  The
+ * blocks are not cleared as a whole, so that a file with few revisions
+ * touches little more than it uses.
+ */
+struct revnode *
+rev_create(struct rcsfile *rcsp, struct rcstext *revtext) {
+	struct revnode *revp;
+	struct revinfo *rip;
+	int i, blk;
+
+	i = rcsp->nrevs;
+	blk = i >> REVBLK_SHIFT;
+	if ((i & (REVBLK - 1)) == 0) {
+		if (blk == rcsp->nrevblk) {
+			rcsp->nrevblk += rcsp->nrevblk + 1;
+			rcsp->revblk = realloc(rcsp->revblk,
+			    (size_t)rcsp->nrevblk * sizeof(*rcsp->revblk));
+			rcsp->infoblk = realloc(rcsp->infoblk,
+			    (size_t)rcsp->nrevblk * sizeof(*rcsp->infoblk));
+		}
+		rcsp->revblk[blk] = arena_alloc(rcsp->arena,
+		    REVBLK * sizeof(**rcsp->revblk));
+		rcsp->infoblk[blk] = arena_alloc(rcsp->arena,
+		    REVBLK * sizeof(**rcsp->infoblk));
+	}
+	revp = REVNODE(rcsp, i);
+	rip = &rcsp->infoblk[blk][i & (REVBLK - 1)];
+	bzero(revp, sizeof(*revp));
+	bzero(rip, sizeof(*rip));
+
+	revp->rcsp = rcsp;
+	revp->info = rip;
+	rip->textlines = NULL;
+	rip->outputlines = NULL;
+	rip->olrefs = 0;
+	rip->branchrevs = textlist_acreate(rcsp->arena);
+	rip->branchpoints = textlist_acreate(rcsp->arena);
+	rip->tags = textlist_acreate(rcsp->arena);
+
+	rip->revtext = *revtext;
+	if (text2num(&rip->revtext, &revp->rev, rcsp->arena) != 0)
+		diag_fatal(rcsp->diag, "text2num: parse failed '%.*s'",
+		    (int)revtext->len, revtext->start);
+	if (namedobjlist_lookup(rcsp->revsbynum, revp->rev.num,
+	    RCSNUM_BYTES(&revp->rev)) != NULL)
+		diag_fatal(rcsp->diag, "%s: duplicate revision '%.*s'",
+		    rcsp->filename, (int)revtext->len, revtext->start);
+	namedobjlist_additem(rcsp->revs, revtext->start, revtext->len, revp);
+	namedobjlist_additem(rcsp->revsbynum, revp->rev.num,
+	    RCSNUM_BYTES(&revp->rev), revp);
+	rcsp->nrevs++;
+
+	return revp;
+}
+
 static void
 get_admin(struct parser *pp, struct rcsfile *rcsp) {
 	struct token tok;
@@ -323,90 +547,135 @@ get_admin(struct parser *pp, struct rcsfile *rcsp) {
 			puttok(pp, &tok);
 			break;
 		}
-		switch (id) {
-		case ID_HEAD:
-			if (optional_tok(pp, &tok, TOKTYPE_NUM))
-				rcsp->headrev = tok.value;
-			break;
-		case ID_BRANCH:
-			if (optional_tok(pp, &tok, TOKTYPE_NUM))
-				rcsp->branch = tok.value;
-			break;
-		case ID_ACCESS:
-			while (optional_tok(pp, &tok, TOKTYPE_ID))
-				textlist_add(rcsp->access, &tok.value);
-			break;
-		case ID_SYMBOLS:
-			while (optional_tok(pp, &tok, TOKTYPE_ID)) {
-				struct rcsnum *nump;
-				struct rcstext symbol = tok.value;
+		(*admin_phrases[id])(pp, rcsp, NULL, &tok);
+	}
+
+}
+
+static void
+admin_head(struct parser *pp, struct rcsfile *rcsp,
+    struct revnode *revp GCC_UNUSED, struct token *keyp GCC_UNUSED) {
+	struct token tok;
+
+	if (optional_tok(pp, &tok, TOKTYPE_NUM))
+		rcsp->headrev = tok.value;
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
+}
 
-				expect_tok(pp, &tok, TOKTYPE_COLON);
-				expect_tok(pp, &tok, TOKTYPE_NUM);
+static void
+admin_branch(struct parser *pp, struct rcsfile *rcsp,
+    struct revnode *revp GCC_UNUSED, struct token *keyp GCC_UNUSED) {
+	struct token tok;
+
+	if (optional_tok(pp, &tok, TOKTYPE_NUM))
+		rcsp->branch = tok.value;
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
+}
+
+static void
+admin_access(struct parser *pp, struct rcsfile *rcsp,
+    struct revnode *revp GCC_UNUSED, struct token *keyp GCC_UNUSED) {
+	struct token tok;
+
+	while (optional_tok(pp, &tok, TOKTYPE_ID))
+		textlist_add(rcsp->access, &tok.value);
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
+}
+
+static void
+admin_symbols(struct parser *pp, struct rcsfile *rcsp,
+    struct revnode *revp GCC_UNUSED, struct token *keyp GCC_UNUSED) {
+	struct token tok;
+
+	while (optional_tok(pp, &tok, TOKTYPE_ID)) {
+		struct rcsnum *nump;
+		struct rcstext symbol = tok.value;
+
+		expect_tok(pp, &tok, TOKTYPE_COLON);
+		expect_tok(pp, &tok, TOKTYPE_NUM);
 #if 0
-				printf("symbol: '%.*s' -> '%.*s'\n",
-				    symbol.len, symbol.start,
-				    tok.value.len, tok.value.start);
+		printf("symbol: '%.*s' -> '%.*s'\n",
+		    (int)symbol.len, symbol.start,
+		    (int)tok.value.len, tok.value.start);
 #endif
 
-				if (namedobjlist_lookup(rcsp->symbols,
-				    symbol.start, symbol.len) != NULL) {
-					warnx("Duplicate symbol '%.*s'",
-					    symbol.len, symbol.start);
-					continue;
-				}
-
-				nump = malloc(sizeof(*nump));
-				numinit(nump);
-				text2num(&tok.value, nump);
-				namedobjlist_additem(rcsp->symbols,
-				    symbol.start, symbol.len, nump);
-			}
-			break;
-		case ID_LOCKS:
-			while (optional_tok(pp, &tok, TOKTYPE_ID)) {
-				expect_tok(pp, &tok, TOKTYPE_COLON);
-				expect_tok(pp, &tok, TOKTYPE_NUM);
-			}
-			expect_tok(pp, &tok, TOKTYPE_SEMI);
-			if (!optional_tok(pp, &tok, TOKTYPE_ID))
-				continue;
-			if (!txtequ(&tok.value, &id_strict)) {
-				puttok(pp, &tok);
-				continue;
-			}
-			break;
-		case ID_COMMENT:
-			if (optional_tok(pp, &tok, TOKTYPE_STRING))
-				rcsp->comment = tok.value;
-			break;
-		case ID_COMMITID:
-			if (optional_tok(pp, &tok, TOKTYPE_ID))
-				rcsp->commitid = tok.value;
-			break;
-		case ID_EXPAND:
-			if (optional_tok(pp, &tok, TOKTYPE_STRING))
-				rcsp->expand = tok.value;
-			break;
-		default:
-			printf("unknown: '%.*s'", tok.value.len,
-			    tok.value.start);
-			while (gettok(pp, &tok)) {
-				if (tok.type != TOKTYPE_ID &&
-				    tok.type != TOKTYPE_NUM &&
-				    tok.type != TOKTYPE_STRING &&
-				    tok.type != TOKTYPE_COLON)
-					break;
-				printf(" [%s]'%.*s'", tokname[tok.type],
-				    tok.value.len, tok.value.start);
-			}
-			puttok(pp, &tok);
-			printf("\n");
-			break;
+		if (namedobjlist_lookup(rcsp->symbols, symbol.start,
+		    symbol.len) != NULL) {
+			diag_warnx(rcsp->diag, "Duplicate symbol '%.*s'",
+			    (int)symbol.len, symbol.start);
+			continue;
 		}
-		expect_tok(pp, &tok, TOKTYPE_SEMI);
+
+		nump = arena_alloc(rcsp->arena, sizeof(*nump));
+		numinit(nump);
+		if (text2num(&tok.value, nump, rcsp->arena) != 0)
+			diag_fatal(rcsp->diag, "text2num: parse failed '%.*s'",
+			    (int)tok.value.len, tok.value.start);
+		namedobjlist_additem(rcsp->symbols, symbol.start, symbol.len,
+		    nump);
 	}
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
+}
+
+/*
+ * "locks" may be followed by a "strict;" phrase, which is read here.
+ */
+static void
+admin_locks(struct parser *pp, struct rcsfile *rcsp GCC_UNUSED,
+    struct revnode *revp GCC_UNUSED, struct token *keyp GCC_UNUSED) {
+	struct token tok;
+
+	while (optional_tok(pp, &tok, TOKTYPE_ID)) {
+		expect_tok(pp, &tok, TOKTYPE_COLON);
+		expect_tok(pp, &tok, TOKTYPE_NUM);
+	}
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
+	if (!optional_tok(pp, &tok, TOKTYPE_ID))
+		return;
+	if (id_lookup(&tok.value) != ID_STRICT) {
+		puttok(pp, &tok);
+		return;
+	}
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
+}
+
+static void
+admin_comment(struct parser *pp, struct rcsfile *rcsp,
+    struct revnode *revp GCC_UNUSED, struct token *keyp GCC_UNUSED) {
+	struct token tok;
 
+	if (optional_tok(pp, &tok, TOKTYPE_STRING))
+		rcsp->comment = tok.value;
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
+}
+
+static void
+admin_commitid(struct parser *pp, struct rcsfile *rcsp,
+    struct revnode *revp GCC_UNUSED, struct token *keyp GCC_UNUSED) {
+	struct token tok;
+
+	if (optional_tok(pp, &tok, TOKTYPE_ID))
+		rcsp->commitid = tok.value;
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
+}
+
+static void
+admin_expand(struct parser *pp, struct rcsfile *rcsp,
+    struct revnode *revp GCC_UNUSED, struct token *keyp GCC_UNUSED) {
+	struct token tok;
+
+	if (optional_tok(pp, &tok, TOKTYPE_STRING))
+		rcsp->expand = tok.value;
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
+}
+
+static void
+admin_unknown(struct parser *pp, struct rcsfile *rcsp,
+    struct revnode *revp GCC_UNUSED, struct token *keyp) {
+	struct token tok;
+
+	skip_phrase(pp, rcsp, "", keyp);
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
 }
 
 static void
@@ -416,78 +685,137 @@ get_deltas(struct parser *pp, struct rcsfile *rcsp) {
 	int id;
 
 	while (optional_tok(pp, &tok, TOKTYPE_NUM)) {
-		revp = malloc(sizeof(*revp));
-		bzero(revp, sizeof(*revp));
-		revp->rcsp = rcsp;
-		revp->textlines = NULL;
-		revp->outputlines = NULL;
-		revp->olrefs = 0;
-		revp->branchrevs = textlist_create();
-		revp->branchpoints = textlist_create();
-		revp->branches = textlist_create();
-		revp->tags = textlist_create();
-
-		revp->revtext = tok.value;
-		text2num(&revp->revtext, &revp->rev);
-		namedobjlist_additem(rcsp->revs, tok.value.start,
-		    tok.value.len, revp);
-		namedobjlist_additem(rcsp->revsbynum, revp->rev.num,
-		    RCSNUM_BYTES(&revp->rev), revp);
-		rcsp->nrevs++;
+		revp = rev_create(rcsp, &tok.value);
 
 		while (optional_tok(pp, &tok, TOKTYPE_ID)) {
 			if ((id = id_lookup(&tok.value)) == ID_DESC) {
 				puttok(pp, &tok);
 				break;
 			}
-			switch (id) {
-			case ID_DATE:
-				expect_tok(pp, &tok, TOKTYPE_NUM);
-				text2num(&tok.value, &revp->date);
-				if (revp->date.num[0] < 100)
-					revp->date.num[0] += 1900;
-				break;
-			case ID_AUTHOR:
-				expect_tok(pp, &tok, TOKTYPE_ID);
-				revp->author = tok.value;
-				break;
-			case ID_STATE:
-				if (optional_tok(pp, &tok, TOKTYPE_ID))
-					revp->state = tok.value;
-				break;
-			case ID_BRANCHES:
-				while (optional_tok(pp, &tok, TOKTYPE_NUM)) {
-					textlist_add(revp->branchrevs,
-					    &tok.value);
-				}
-				break;
-			case ID_NEXT:
-				if (optional_tok(pp, &tok, TOKTYPE_NUM))
-					revp->patchnextrev = tok.value;
-				break;
-			case ID_COMMITID:
-				if (optional_tok(pp, &tok, TOKTYPE_ID))
-					rcsp->commitid = tok.value;
-				break;
-			default:
-				printf("delta unknown: '%.*s'", tok.value.len,
-				    tok.value.start);
-				while (gettok(pp, &tok)) {
-					if (tok.type != TOKTYPE_ID &&
-					    tok.type != TOKTYPE_NUM &&
-					    tok.type != TOKTYPE_STRING &&
-					    tok.type != TOKTYPE_COLON)
-						break;
-					printf(" [%s]'%.*s'", tokname[tok.type],
-					    tok.value.len, tok.value.start);
-				}
-				puttok(pp, &tok);
-				printf("\n");
-				break;
-			}
-			expect_tok(pp, &tok, TOKTYPE_SEMI);
+			(*delta_phrases[id])(pp, rcsp, revp, &tok);
 		}
+		rev_filter(revp);
+	}
+}
+
+/*
+ * Hide revp from revlist() if the file's filter leaves it out.  It is
+ * kept, and its deltatext read if another revision is made from it.
+ */
+static void
+rev_filter(struct revnode *revp) {
+	const struct rcsfilter *fp = revp->rcsp->filter;
+	struct rcstext *author = &revp->info->author;
+
+	if (fp != NULL &&
+	    ((fp->since.len != 0 && numcmp(&revp->info->date,
+	    &fp->since) < 0) ||
+	    (fp->until.len != 0 && numcmp(&revp->info->date,
+	    &fp->until) > 0) ||
+	    (fp->author != NULL &&
+	    ((size_t)author->len != strlen(fp->author) ||
+	    bcmp(author->start, fp->author, (size_t)author->len) != 0))))
+		revp->hidden = 1;
+	else
+		revp->rcsp->nshown++;
+}
+
+static void
+delta_date(struct parser *pp, struct rcsfile *rcsp, struct revnode *revp,
+    struct token *keyp GCC_UNUSED) {
+	struct rcsnum *date = &revp->info->date;
+	struct token tok;
+
+	expect_tok(pp, &tok, TOKTYPE_NUM);
+	if (text2num(&tok.value, date, rcsp->arena) != 0)
+		diag_fatal(rcsp->diag, "text2num: parse failed '%.*s'",
+		    (int)tok.value.len, tok.value.start);
+	if (date->num[0] < 100)
+		date->num[0] += 1900;
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
+}
+
+static void
+delta_author(struct parser *pp, struct rcsfile *rcsp GCC_UNUSED,
+    struct revnode *revp, struct token *keyp GCC_UNUSED) {
+	struct token tok;
+
+	expect_tok(pp, &tok, TOKTYPE_ID);
+	revp->info->author = tok.value;
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
+}
+
+static void
+delta_state(struct parser *pp, struct rcsfile *rcsp GCC_UNUSED,
+    struct revnode *revp, struct token *keyp GCC_UNUSED) {
+	struct token tok;
+
+	if (optional_tok(pp, &tok, TOKTYPE_ID))
+		revp->info->state = tok.value;
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
+}
+
+static void
+delta_branches(struct parser *pp, struct rcsfile *rcsp GCC_UNUSED,
+    struct revnode *revp, struct token *keyp GCC_UNUSED) {
+	struct token tok;
+
+	while (optional_tok(pp, &tok, TOKTYPE_NUM))
+		textlist_add(revp->info->branchrevs, &tok.value);
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
+}
+
+static void
+delta_next(struct parser *pp, struct rcsfile *rcsp GCC_UNUSED,
+    struct revnode *revp, struct token *keyp GCC_UNUSED) {
+	struct token tok;
+
+	if (optional_tok(pp, &tok, TOKTYPE_NUM))
+		revp->info->patchnextrev = tok.value;
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
+}
+
+static void
+delta_commitid(struct parser *pp, struct rcsfile *rcsp,
+    struct revnode *revp GCC_UNUSED, struct token *keyp GCC_UNUSED) {
+	struct token tok;
+
+	if (optional_tok(pp, &tok, TOKTYPE_ID))
+		rcsp->commitid = tok.value;
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
+}
+
+static void
+delta_unknown(struct parser *pp, struct rcsfile *rcsp,
+    struct revnode *revp GCC_UNUSED, struct token *keyp) {
+	struct token tok;
+
+	skip_phrase(pp, rcsp, "delta ", keyp);
+	expect_tok(pp, &tok, TOKTYPE_SEMI);
+}
+
+/*
+ * Report a phrase we don't know and skip its words, up to the ';' or the
+ * next keyword.
+ */
+static void
+skip_phrase(struct parser *pp, struct rcsfile *rcsp, const char *section,
+    struct token *keyp) {
+	struct token tok;
+
+	diag_printf(rcsp->diag, "%sunknown: '%.*s'", section,
+	    (int)keyp->value.len, keyp->value.start);
+	while (gettok(pp, &tok)) {
+		if (tok.type != TOKTYPE_ID &&
+		    tok.type != TOKTYPE_NUM &&
+		    tok.type != TOKTYPE_STRING &&
+		    tok.type != TOKTYPE_COLON)
+			break;
+		diag_printf(rcsp->diag, " [%s]'%.*s'", tokname[tok.type],
+		    (int)tok.value.len, tok.value.start);
 	}
+	puttok(pp, &tok);
+	diag_printf(rcsp->diag, "\n");
 }
 
 static void
@@ -496,86 +824,120 @@ get_desc(struct parser *pp, struct rcsfile *rcsp) {
 
 	expect_tok(pp, &tok, TOKTYPE_ID);
 	if (id_lookup(&tok.value) != ID_DESC)
-		errx(1, "missing 'desc'\n");
+		diag_fatal(rcsp->diag, "missing 'desc'\n");
 	expect_tok(pp, &tok, TOKTYPE_STRING);
 	rcsp->desc = tok.value;
 }
 
+/*
+ * The deltatexts are read on demand, since most of the file is the log and
+ * text strings and a query for one branch needs only a few of them.  Each
+ * call resumes where the last one stopped, and reads until the block for
+ * "want" has been seen, or to the end of the file if "want" is NULL.
+ */
 static void
-get_deltatexts(struct parser *pp, struct rcsfile *rcsp) {
+get_deltatexts(struct rcsfile *rcsp, struct revnode *want) {
+	struct parser *pp = &rcsp->textparse;
 	struct token tok;
 	struct revnode *revp;
 
-	while (optional_tok(pp, &tok, TOKTYPE_NUM)) {
+	while (!rcsp->textdone) {
+		if (!optional_tok(pp, &tok, TOKTYPE_NUM)) {
+			if (gettok(pp, &tok))
+				diag_fatal(rcsp->diag,
+				    "%s: junk at end of rcs file",
+				    rcsp->filename);
+			rcsp->textdone = 1;
+			break;
+		}
+
 		revp = namedobjlist_lookup(rcsp->revs, tok.value.start,
 		    tok.value.len);
 		if (revp == NULL)
-			errx(1, "rev %.*s not found", tok.value.len,
-			    tok.value.start);
+			diag_fatal(rcsp->diag, "rev %.*s not found",
+			    (int)tok.value.len, tok.value.start);
 
-		while (optional_tok(pp, &tok, TOKTYPE_ID)) {
-			switch (id_lookup(&tok.value)) {
-			case ID_LOG:
-				expect_tok(pp, &tok, TOKTYPE_STRING);
-				revp->log = tok.value;
-				break;
-			case ID_TEXT:
-				expect_tok(pp, &tok, TOKTYPE_STRING);
-				revp->text = tok.value;
-				break;
-			default:
-				printf("deltatext unknown: '%.*s'",
-				    tok.value.len, tok.value.start);
-				while (gettok(pp, &tok)) {
-					if (tok.type != TOKTYPE_ID &&
-					    tok.type != TOKTYPE_NUM &&
-					    tok.type != TOKTYPE_STRING &&
-					    tok.type != TOKTYPE_COLON)
-						break;
-					printf(" [%s]'%.*s'", tokname[tok.type],
-					    tok.value.len, tok.value.start);
-				}
-				puttok(pp, &tok);
-				printf("\n");
-				break;
-			}
-		}
+		while (optional_tok(pp, &tok, TOKTYPE_ID))
+			(*text_phrases[id_lookup(&tok.value)])(pp, rcsp, revp,
+			    &tok);
+
+		if (revp == want)
+			break;
 	}
 }
 
+static void
+text_log(struct parser *pp, struct rcsfile *rcsp GCC_UNUSED,
+    struct revnode *revp, struct token *keyp GCC_UNUSED) {
+	struct token tok;
+
+	expect_tok(pp, &tok, TOKTYPE_STRING);
+	revp->info->log = tok.value;
+}
+
+static void
+text_text(struct parser *pp, struct rcsfile *rcsp GCC_UNUSED,
+    struct revnode *revp, struct token *keyp GCC_UNUSED) {
+	struct token tok;
+
+	expect_tok(pp, &tok, TOKTYPE_STRING);
+	revp->info->text = tok.value;
+}
+
+static void
+text_unknown(struct parser *pp, struct rcsfile *rcsp,
+    struct revnode *revp GCC_UNUSED, struct token *keyp) {
+	skip_phrase(pp, rcsp, "deltatext ", keyp);
+}
+
 static void
 fixup_deltas(struct rcsfile *rcsp) {
 	Namedobjlist_iter *iter;
 	struct revnode *revp;
 	struct rcsnum *nump;
 	struct rcstext symb;
+	int i;
 
-	iter = nol_iter_create(rcsp->revs);
-	while ((revp = nol_iter_next(iter, NULL, NULL)) != NULL) {
+	for (i = 0; i < rcsp->nrevs; i++) {
 		struct revnode *revp1;
+		struct revinfo *rip;
 		struct rcstext *textp;
+		struct branch *bp;
 
-		TEXTLIST_FOREACH(revp->branchrevs, textp) {
+		revp = REVNODE(rcsp, i);
+		rip = revp->info;
+		TEXTLIST_FOREACH(rip->branchrevs, textp) {
 			revp1 = namedobjlist_lookup(rcsp->revs, textp->start,
 			    textp->len);
 			if (revp1 == NULL)
-				errx(1,
+				diag_fatal(rcsp->diag,
 				    "fixup_deltas: missing '%.*s' at '%.*s'",
-				    textp->len, textp->start,
-				    revp->revtext.len, revp->revtext.start);
+				    (int)textp->len, textp->start,
+				    (int)rip->revtext.len, rip->revtext.start);
 
 			revp1->patchprev = revp;
+
+			if (revp1->rev.len < 2 || namedobjlist_lookup(
+			    rcsp->branches, revp1->rev.num,
+			    RCSNUM_BRBYTES(&revp1->rev)) != NULL)
+				continue;
+			bp = arena_calloc(rcsp->arena, sizeof(*bp));
+			bp->start = revp1;
+			namedobjlist_additem(rcsp->branches, revp1->rev.num,
+			    RCSNUM_BRBYTES(&revp1->rev), bp);
 		}
 
-		if (revp->patchnextrev.start == NULL)
+		if (rip->patchnextrev.start == NULL)
 			continue;
 
 		revp1 = namedobjlist_lookup(rcsp->revs,
-		    revp->patchnextrev.start, revp->patchnextrev.len);
+		    rip->patchnextrev.start, rip->patchnextrev.len);
 		if (revp1 == NULL) {
-			printf("fixup_deltas: missing rev '%.*s' at '%.*s'\n",
-			    revp->patchnextrev.len, revp->patchnextrev.start,
-			    revp->revtext.len, revp->revtext.start);
+			diag_printf(rcsp->diag,
+			    "fixup_deltas: missing rev '%.*s' at '%.*s'\n",
+			    (int)rip->patchnextrev.len,
+			    rip->patchnextrev.start,
+			    (int)rip->revtext.len, rip->revtext.start);
 			continue;
 		}
 
@@ -583,8 +945,8 @@ fixup_deltas(struct rcsfile *rcsp) {
 		revp1->patchprev = revp;
 	}
 
-	nol_iter_reset(iter);
-	while ((revp = nol_iter_next(iter, NULL, NULL)) != NULL) {
+	for (i = 0; i < rcsp->nrevs; i++) {
+		revp = REVNODE(rcsp, i);
 		if ((revp->patchnext != NULL && numcmp(&revp->patchnext->rev,
 		    &revp->rev) < 0) || (revp->patchprev != NULL &&
 		    numcmp(&revp->patchprev->rev, &revp->rev) > 0)) {
@@ -594,27 +956,27 @@ fixup_deltas(struct rcsfile *rcsp) {
 			revp->next = revp->patchnext;
 			revp->prev = revp->patchprev;
 		}
+		revp->sortkey = datekey(&revp->info->date);
 	}
-	nol_iter_destroy(iter);
 
 	rcsp->head = namedobjlist_lookup(rcsp->revs, rcsp->headrev.start,
 	    rcsp->headrev.len);
 	if (rcsp->head == NULL)
-		errx(1,"head revision '%.*s' not found!\n", rcsp->headrev.len,
-		    rcsp->headrev.start);
+		diag_fatal(rcsp->diag, "head revision '%.*s' not found!\n",
+		    (int)rcsp->headrev.len, rcsp->headrev.start);
 
+	namedobjlist_sizehint(rcsp->revtags, rcsp->symbols->nitems);
 	iter = nol_iter_create(rcsp->symbols);
 	while ((nump = nol_iter_next(iter, (const void **)&symb.start,
 	    &symb.len)) != NULL) {
 		struct rcsnum num;
-		struct rcstext *textp;
 		struct textlist *tlp;
-		int found;
+		struct branch *bp;
 
 		tlp = namedobjlist_lookup(rcsp->revtags, nump->num,
 		     RCSNUM_BYTES(nump));
 		if (tlp == NULL) {
-			tlp = textlist_create();
+			tlp = textlist_acreate(rcsp->arena);
 			namedobjlist_additem(rcsp->revtags, nump->num,
 			    RCSNUM_BYTES(nump), tlp);
 		}
@@ -624,7 +986,7 @@ fixup_deltas(struct rcsfile *rcsp) {
 			/* Not a branch symbol */
 			if ((revp = namedobjlist_lookup(rcsp->revsbynum,
 			    nump->num, RCSNUM_BYTES(nump))) != NULL)
-				textlist_add(revp->tags, &symb);
+				textlist_add(revp->info->tags, &symb);
 			continue;
 		}
 
@@ -635,46 +997,35 @@ fixup_deltas(struct rcsfile *rcsp) {
 		revp = namedobjlist_lookup(rcsp->revsbynum, num.num,
 		    RCSNUM_BYTES(&num));
 		if (revp == NULL)
-			errx(1, "base revision for '%.*s' not found",
-			    symb.len, symb.start);
+			diag_fatal(rcsp->diag,
+			    "base revision for '%.*s' not found",
+			    (int)symb.len, symb.start);
 
 		num.num[num.len] = num.num[num.len + 1];
 		num.len++;
 
-		textlist_add(revp->branchpoints, &symb);
-
-		found = 0;
-		TEXTLIST_FOREACH(revp->branchrevs, textp) {
-			struct rcsnum brnum;
-
-			numinit(&brnum);
-			text2num(textp, &brnum);
-			if (brnum.len == num.len +1 && bcmp(brnum.num,
-			    num.num, (size_t)RCSNUM_BYTES(&num)) == 0) {
-				numfree(&brnum);
-				found = 1;
-				break;
-			}
-			numfree(&brnum);
-		}
+		textlist_add(revp->info->branchpoints, &symb);
 
-		if (found) {
-			revp = namedobjlist_lookup(rcsp->revs, textp->start,
-			    textp->len);
-			if (revp == NULL)
-				errx(1, "branch '%.*s': rev '%.*s' not found",
-				    symb.len, symb.start, textp->len,
-				    textp->start);
-
-			while (revp->next != NULL) {
-				textlist_add(revp->branches, &symb);
-				revp = revp->next;
+		/*
+		 * A branch with revisions takes its head from the end of
+		 * the branch, found only once however many symbols name it.
+		 */
+		bp = namedobjlist_lookup(rcsp->branches, num.num,
+		    RCSNUM_BYTES(&num));
+		if (bp != NULL) {
+			if (bp->head == NULL) {
+				bp->head = bp->start;
+				while (bp->head->next != NULL)
+					bp->head = bp->head->next;
+				bp->symbols = textlist_acreate(rcsp->arena);
 			}
-			textlist_add(revp->branches, &symb);
+			textlist_add(bp->symbols, &symb);
+			revp = bp->head;
 		}
 
 		namedobjlist_additem(rcsp->branchhead, symb.start, symb.len,
 		    revp);
+		numfree(&num);
 	}
 	nol_iter_destroy(iter);
 }
@@ -682,19 +1033,16 @@ fixup_deltas(struct rcsfile *rcsp) {
 struct revnode **
 revlist(struct rcsfile *rcsp, char *branch) {
 	struct revnode **list, *revp;
-	int i = 0;
+	int i = 0, n = 0;
 
 	list = calloc((size_t)rcsp->nrevs + 1, sizeof(*list));
 
 	if (branch == NULL || strcmp(branch, "ALL") == 0) {
-		Namedobjlist_iter *iter;
+		for (i = n = 0; i < rcsp->nrevs; i++)
+			if (!REVNODE(rcsp, i)->hidden)
+				list[n++] = REVNODE(rcsp, i);
 
-		iter = nol_iter_create(rcsp->revs);
-		while ((revp = nol_iter_next(iter, NULL, NULL)) != NULL)
-			list[i++] = revp;
-		nol_iter_destroy(iter);
-
-		qsort(list, (size_t)rcsp->nrevs, sizeof(*list), revbydate);
+		qsort(list, (size_t)n, sizeof(*list), revbydate);
 		return list;
 	}
 
@@ -710,106 +1058,330 @@ revlist(struct rcsfile *rcsp, char *branch) {
 	}
 
 	while (revp != NULL) {
-		if (i == rcsp->nrevs)
-			GIVE_UP();
-		list[i++] = revp;
+		if (i++ == rcsp->nrevs)
+			diag_fatal(rcsp->diag, "%s: loop in branch %s",
+			    rcsp->filename, branch);
+		if (!revp->hidden)
+			list[n++] = revp;
 		revp = revp->prev;
 	}
 
 	return list;
 }
 
-void
-rev_calc(struct revnode *revp) {
-	struct rcstext *textp;
-	struct rcspatch *pp;
-	struct rcspatch_op *opp;
-	int i;
+/*
+ * The branch symbols which apply to revp, or NULL.
+ */
+struct textlist *
+rev_branches(struct revnode *revp) {
+	struct branch *bp;
 
-	if (revp->outputlines != NULL)
+	if (revp->rev.len < 4)
+		return NULL;
+	bp = namedobjlist_lookup(revp->rcsp->branches, revp->rev.num,
+	    RCSNUM_BRBYTES(&revp->rev));
+	return bp != NULL ? bp->symbols : NULL;
+}
+
+/*
+ * Make sure the log and text of revp have been read.
+ */
+void
+rev_loadtext(struct revnode *revp) {
+	if (revp->info->log.start == NULL)
+		get_deltatexts(revp->rcsp, revp);
+}
+
+/*
+ * Work out the lines of revp.  The revisions between it and the nearest
+ * one whose lines are known are stacked, then built oldest first, each
+ * held until the next has been made from it.  This needs no recursion,
+ * however long the delta chain.
+ */
+void
+rev_calc(struct revnode *revp) {
+	struct rcsfile *rcsp = revp->rcsp;
+	struct revnode **stack, *rp, *last;
+	int n, len;
+
+	if (revp->info->outputlines != NULL) {
+		textcache_hit(revp);
 		return;
+	}
+	if (rcsp->flags & RCSFILE_NOTEXT)
+		GIVE_UP();
 
-	if (revp->textlines == NULL)
-		revp->textlines = textsplit(&revp->text);
-	revp->outputlines = textlist_create();
+	stack = NULL;
+	n = len = 0;
+	for (rp = revp; rp != NULL && rp->info->outputlines == NULL;
+	    rp = rp->patchprev) {
+		if (n == rcsp->nrevs)
+			diag_fatal(rcsp->diag, "%s: loop in deltas at %.*s",
+			    rcsp->filename, (int)rp->info->revtext.len,
+			    rp->info->revtext.start);
+		if (n == len) {
+			len += len + 16;
+			stack = realloc(stack, (size_t)len * sizeof(*stack));
+		}
+		stack[n++] = rp;
+		rev_addref(rp);
+	}
+
+	last = NULL;
+	while (n > 0) {
+		rp = stack[--n];
+		rev_build(rp);
+		if (last != NULL)
+			rev_remref(last);
+		last = rp;
+	}
+	rev_remref(last);
+	free(stack);
+}
+
+/*
+ * Make the lines of revp, as pieces of those of the revision it is
+ * patched from, which must be known, and of its own delta.
+ */
+static void
+rev_build(struct revnode *revp) {
+	struct rcsfile *rcsp = revp->rcsp;
+	struct revinfo *rip = revp->info;
+	struct rcspatch *pp;
+	struct rcspatch_op *opp;
+
+	rev_loadscript(revp);
+
+	/*
+	 * With RCSFILE_LOWMEM most of the output lines are freed again
+	 * by rev_remref(), and with a text cache they may be evicted, so
+	 * they can't come from the arena.
+	 */
+	if ((rcsp->flags & RCSFILE_LOWMEM) || textcache_budget() != 0) {
+		rip->outputlines = pt_create(NULL);
+		rcsp->nheaplines++;
+	} else
+		rip->outputlines = pt_create(rcsp->arena);
 
 	if ((pp = makepatch(revp)) == NULL) {
-		TEXTLIST_FOREACH(revp->textlines, textp)
-			textlist_add(revp->outputlines, textp);
+		pt_add(rip->outputlines, rip->textlines->list,
+		    rip->textlines->len);
+		textcache_add(revp);
 		return;
 	}
 
+	/* Each op adds a piece, or splits one of the old revision's */
+	pt_reserve(rip->outputlines,
+	    revp->patchprev->info->outputlines->len + pp->len);
 	for (opp = pp->op; opp < &pp->op[pp->len]; opp++) {
-		if (opp->op == RPOP_DEL)
-			continue;
-
-		for (i = 0; i < opp->len; i++)
-			textlist_add(revp->outputlines, &opp->textp[i]);
+		if (opp->op == RPOP_ADD)
+			pt_add(rip->outputlines, opp->textp, opp->len);
+		else if (opp->op == RPOP_COPY)
+			pt_addpieces(rip->outputlines, &opp->pos, opp->len);
 	}
 	patch_destroy(pp);
+	textcache_add(revp);
 }
 
 void
 rev_diff(struct revnode *revp, int ctx, int reverse) {
-	struct revnode *rp;
-	struct rcstext *textp;
-	struct rcspatch *pp;
-	struct rcspatch_op *opp;
-	int chunkend;
-	int i;
+	struct rcsdiff diff;
+
+	rev_diffstart(revp, reverse, &diff);
+	rev_diffprint(&diff, ctx);
+	rev_diffend(&diff);
+}
+
+/*
+ * rev_diff() in three steps, for threads which share the file: this one
+ * builds what the patch needs, and holds the lines it is made from in dp,
+ * rev_diffprint() prints it without changing anything kept for the file,
+ * and rev_diffend() lets the lines go.
+ */
+void
+rev_diffstart(struct revnode *revp, int reverse, struct rcsdiff *dp) {
+	dp->whole = NULL;
+	dp->patch = NULL;
+	dp->reverse = reverse;
 
 	if (revp->prev == NULL) {
-		if (revp->outputlines == NULL)
+		rev_addref(revp);
+		if (revp->info->outputlines == NULL)
 			rev_calc(revp);
-		TEXTLIST_FOREACH(revp->outputlines, textp)
-			textprint(textp);
+		dp->whole = revp;
 		return;
 	}
 
 	if (revp->patchprev != revp->prev) {
-		reverse = !reverse;
+		dp->reverse = !reverse;
 		revp = revp->prev;
 	}
 
 	rev_calc(revp);
+	dp->patch = makepatch(revp);
+}
+
+void
+rev_diffprint(struct rcsdiff *dp, int ctx) {
+	const struct piece *pcp;
+	struct rcstext *textp;
+
+	if (dp->whole != NULL) {
+		PIECETABLE_FOREACH(dp->whole->info->outputlines, pcp, textp)
+			textprint(textp);
+		return;
+	}
+	patch_print(dp->patch, dp->patch->newnode, ctx, dp->reverse);
+}
+
+void
+rev_diffend(struct rcsdiff *dp) {
+	if (dp->whole != NULL)
+		rev_remref(dp->whole);
+	else
+		patch_destroy(dp->patch);
+}
+
+/*
+ * Count the lines which rev_diff() would show as added and deleted, from
+ * the commands of the deltas alone, without building any revision.
+ */
+void
+rev_diffstat(struct revnode *revp, long *addp, long *delp) {
+	*addp = *delp = 0;
+
+	if (revp->prev == NULL) {
+		*addp = rev_nlines(revp);
+		return;
+	}
+
+	/* As in rev_diff(), the delta may run the other way */
+	if (revp->patchprev != revp->prev)
+		delta_count(revp->prev, delp, addp);
+	else
+		delta_count(revp, addp, delp);
+}
+
+/*
+ * Add up the counts of the 'a' and 'd' commands of the delta of revp.
+ * The lines added are skipped, not split.
+ */
+static void
+delta_count(struct revnode *revp, long *addp, long *delp) {
+	struct revinfo *rip = revp->info;
+	struct edcmd *ecp;
+	const char *p, *end;
+	char *q;
+	char op;
+	long n;
+
+	if (rip->script != NULL) {
+		for (ecp = rip->script; ecp < &rip->script[rip->scriptlen];
+		    ecp++) {
+			if (ecp->op == 'a')
+				*addp += ecp->count;
+			else if (ecp->op == 'd')
+				*delp += ecp->count;
+		}
+		return;
+	}
+
+	rev_loadtext(revp);
+	p = rip->text.start;
+	end = p + rip->text.len;
+	while (p != NULL && p < end) {
+		op = *p++;
+		strtoul(p, &q, 10);
+		n = (long)strtoul(q, &q, 10);
+		if ((p = memchr(q, '\n', (size_t)(end - q))) != NULL)
+			p++;
+		if (op == 'd')
+			*delp += n;
+		else if (op == 'a') {
+			*addp += n;
+			while (n-- > 0 && p != NULL && p < end)
+				if ((p = memchr(p, '\n',
+				    (size_t)(end - p))) != NULL)
+					p++;
+		}
+	}
+}
+
+/*
+ * The number of lines in revp, worked out from the nearest revision whose
+ * lines are known, or from the head of its delta chain.
+ */
+static long
+rev_nlines(struct revnode *revp) {
+	struct rcsfile *rcsp = revp->rcsp;
+	struct revnode *rp;
+	const char *p, *end;
+	long add, del, n;
+	int depth;
+
+	n = 0;
+	depth = 0;
+	for (rp = revp; rp->patchprev != NULL &&
+	    rp->info->outputlines == NULL; rp = rp->patchprev) {
+		if (++depth > rcsp->nrevs)
+			diag_fatal(rcsp->diag, "%s: loop in deltas at %.*s",
+			    rcsp->filename, (int)rp->info->revtext.len,
+			    rp->info->revtext.start);
+		add = del = 0;
+		delta_count(rp, &add, &del);
+		n += add - del;
+	}
+
+	if (rp->info->outputlines != NULL)
+		return n + rp->info->outputlines->nlines;
+
+	rev_loadtext(rp);
+	p = rp->info->text.start;
+	end = p + rp->info->text.len;
+	for (; p != NULL && p < end; n++)
+		if ((p = memchr(p, '\n', (size_t)(end - p))) != NULL)
+			p++;
+	return n;
+}
+
+/*
+ * Print the patch pp made for revp, in unified format with ctx lines of
+ * context, or the other way round if reverse is set.
+ */
+static void
+patch_print(struct rcspatch *pp, struct revnode *revp, int ctx,
+    int reverse) {
+	struct revnode *rp;
+	struct rcspatch_op *opp;
+	long chunkend;
 
-	pp = makepatch(revp);
 	if (reverse)
 		reversepatch(pp);
 
 	rp = reverse ? revp : revp->patchprev;
-	printf("--- %.*s\t%d/%02d/%02d %02d:%02d:%02d\t%.*s\n",
-	    rp->rcsp->shortfname.len, rp->rcsp->shortfname.start,
-	    rp->date.num[0], rp->date.num[1], rp->date.num[2],
-	    rp->date.num[3], rp->date.num[4], rp->date.num[5],
-	    rp->revtext.len, rp->revtext.start);
+	out_str("--- ");
+	patch_printname(rp);
 	rp = reverse ? revp->patchprev : revp;
-	printf("+++ %.*s\t%d/%02d/%02d %02d:%02d:%02d\t%.*s\n",
-	    rp->rcsp->shortfname.len, rp->rcsp->shortfname.start,
-	    rp->date.num[0], rp->date.num[1], rp->date.num[2],
-	    rp->date.num[3], rp->date.num[4], rp->date.num[5],
-	    rp->revtext.len, rp->revtext.start);
+	out_str("+++ ");
+	patch_printname(rp);
 
 
 
 	chunkend = 0;
 	for (opp = pp->op; opp < &pp->op[pp->len]; opp++) {
-		int cstart, ocount, coff;
+		long cstart, ocount, coff;
 		struct rcspatch_op *copp;
 
 		/* Deal with the simple cases */
 		if (opp->op == RPOP_ADD || opp->op == RPOP_DEL ||
 		    opp->line + opp->len < chunkend) {
-			patch_printop(opp, opp->op == RPOP_ADD ? "+" :
-			    opp->op == RPOP_DEL ? "-" : " ");
+			patch_printop(opp, 0, opp->len, opp->op == RPOP_ADD ?
+			    "+" : opp->op == RPOP_DEL ? "-" : " ");
 			continue;
 		}
 
 		/* End the current chunk */
-		for (i = 0; i + opp->line < chunkend; i++) {
-			fputc(' ', stdout);
-			textprint(&opp->textp[i]);
-		}
+		patch_printop(opp, 0, chunkend - opp->line, " ");
 
 		/* Check for end of patch */
 		if (opp - pp->op == pp->len - 1)
@@ -841,28 +1413,40 @@ rev_diff(struct revnode *revp, int ctx, int reverse) {
 		}
 
 		/* Start the new chunk */
-		printf("@@ -%d,%d +%d,%d @@\n", cstart + 1, chunkend - cstart,
-		    opp->nline + coff + 1, ocount);
-		for (i = coff; i < opp->len; i++) {
-			fputc(' ', stdout);
-			textprint(&opp->textp[i]);
-		}
+		out_str("@@ -");
+		out_long(cstart + 1, 0);
+		out_char(',');
+		out_long(chunkend - cstart, 0);
+		out_str(" +");
+		out_long(opp->nline + coff + 1, 0);
+		out_char(',');
+		out_long(ocount, 0);
+		out_str(" @@\n");
+		patch_printop(opp, coff, opp->len, " ");
 	}
-	patch_destroy(pp);
 }
 
+/*
+ * The output lines of a revision are held while a reference is counted
+ * in olrefs.  The count is not atomic: threads sharing a file must hold
+ * one lock for it around these, and around all that builds its lines.
+ */
 void
 rev_addref(struct revnode *revp) {
-	revp->olrefs++;
+	revp->info->olrefs++;
 }
 
 void
 rev_remref(struct revnode *revp) {
-	if (--revp->olrefs < 0)
+	struct revinfo *rip = revp->info;
+
+	if (--rip->olrefs < 0)
 		GIVE_UP();
-	if (!(revp->rcsp->flags & RCSFILE_LOWMEM) || revp->olrefs != 0)
+	if (rip->olrefs == 0)
+		textcache_release(revp);
+	if (!(revp->rcsp->flags & RCSFILE_LOWMEM) || rip->olrefs != 0)
 		return;
-	if (revp->outputlines == NULL || revp->prev == NULL)
+	if (rip->outputlines == NULL || revp->prev == NULL)
 		return;
 
 	/*
@@ -872,24 +1456,212 @@ rev_remref(struct revnode *revp) {
 	 */
 	if ((((long)revp * 17702227) & 0xf00) == 0)
 		return;
-	textlist_destroy(revp->outputlines);
-	revp->outputlines = NULL;
+	if (rip->outputlines->arena == NULL)
+		revp->rcsp->nheaplines--;
+	pt_destroy(rip->outputlines);
+	rip->outputlines = NULL;
 }
 
-static void
-patch_printop(struct rcspatch_op *opp, const char *prefix) {
+/*
+ * Whether list, as sorted for output, runs down the trunk from the head,
+ * each revision being followed by the one its delta turns it into.  Such
+ * a list can be shown with a revstream.
+ */
+int
+revstream_ok(struct revnode **list, int n) {
+	struct revnode *prev;
 	int i;
 
-	for (i = 0; i < opp->len; i++) {
-		printf("%s", prefix);
-		textprint(&opp->textp[i]);
+	if (n == 0 || list[0]->patchprev != NULL)
+		return 0;
+	for (i = 0; i < n; i++) {
+		if ((prev = list[i]->prev) == NULL)
+			return i == n - 1;
+		if (prev->patchprev != list[i] ||
+		    (i < n - 1 && list[i + 1] != prev))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Start a walk down the trunk from head, which must have its full text.
+ */
+struct revstream *
+revstream_create(struct revnode *head) {
+	struct revstream *rsp;
+	struct textlist *tlp;
+
+	rev_loadtext(head);
+	tlp = textsplit(&head->info->text, NULL);
+
+	rsp = malloc(sizeof(*rsp));
+	rsp->cur = head;
+	rsp->size = tlp->len + tlp->len / 8 + 64;
+	rsp->buf = malloc((size_t)rsp->size * sizeof(*rsp->buf));
+	if (tlp->len != 0)
+		bcopy(tlp->list, rsp->buf, (size_t)tlp->len *
+		    sizeof(*rsp->buf));
+	rsp->gap = tlp->len;
+	rsp->gapend = rsp->size;
+	rsp->op = NULL;
+	rsp->op_len = 0;
+	textlist_destroy(tlp);
+
+	return rsp;
+}
+
+void
+revstream_free(struct revstream *rsp) {
+	free(rsp->buf);
+	free(rsp->op);
+	free(rsp);
+}
+
+/*
+ * Print what rev_diff(revp, ctx, 0) would, where revp is the revision in
+ * the buffer, then apply the delta of revp->prev to the buffer in place.
+ * The buffer's two halves serve as the piecetable the patch is made
+ * against, so no other copy of the lines is needed.
+ */
+void
+revstream_diff(struct revstream *rsp, struct revnode *revp, int ctx) {
+	struct piece halves[2];
+	struct piecetable view;
+	struct revnode *prev;
+	struct rcspatch *pp;
+	struct rcspatch_op *opp;
+	long i, n;
+
+	if (revp != rsp->cur)
+		GIVE_UP();
+
+	if ((prev = revp->prev) == NULL) {
+		for (i = 0; i < rsp->gap; i++)
+			textprint(&rsp->buf[i]);
+		for (i = rsp->gapend; i < rsp->size; i++)
+			textprint(&rsp->buf[i]);
+		return;
+	}
+
+	view.list = halves;
+	view.len = 0;
+	view.list_len = 2;
+	view.nlines = 0;
+	view.arena = NULL;
+	pt_add(&view, rsp->buf, rsp->gap);
+	pt_add(&view, &rsp->buf[rsp->gapend], rsp->size - rsp->gapend);
+
+	rev_loadscript(prev);
+	pp = patch_build(prev, &view);
+
+	/* Printing may reorder the ops, so keep them for the update */
+	if (rsp->op_len < pp->len) {
+		rsp->op_len = pp->len;
+		rsp->op = realloc(rsp->op, (size_t)rsp->op_len *
+		    sizeof(*rsp->op));
+	}
+	n = pp->len;
+	bcopy(pp->op, rsp->op, (size_t)n * sizeof(*rsp->op));
+	patch_print(pp, prev, ctx, 1);
+	patch_destroy(pp);
+
+	for (opp = rsp->op; opp < &rsp->op[n]; opp++) {
+		if (opp->op == RPOP_DEL) {
+			stream_moveto(rsp, opp->nline);
+			if (opp->len > rsp->size - rsp->gapend)
+				GIVE_UP();
+			rsp->gapend += opp->len;
+		} else if (opp->op == RPOP_ADD) {
+			stream_moveto(rsp, opp->nline);
+			if (rsp->gapend - rsp->gap < opp->len) {
+				long size, tail;
+
+				size = rsp->size + rsp->size / 2 + opp->len;
+				tail = rsp->size - rsp->gapend;
+				rsp->buf = realloc(rsp->buf, (size_t)size *
+				    sizeof(*rsp->buf));
+				memmove(&rsp->buf[size - tail],
+				    &rsp->buf[rsp->gapend],
+				    (size_t)tail * sizeof(*rsp->buf));
+				rsp->gapend = size - tail;
+				rsp->size = size;
+			}
+			bcopy(opp->textp, &rsp->buf[rsp->gap],
+			    (size_t)opp->len * sizeof(*rsp->buf));
+			rsp->gap += opp->len;
+		}
+	}
+	rsp->cur = prev;
+}
+
+/*
+ * Move the gap so that it starts before line pos.
+ */
+static void
+stream_moveto(struct revstream *rsp, long pos) {
+	long n;
+
+	if (pos < rsp->gap) {
+		n = rsp->gap - pos;
+		memmove(&rsp->buf[rsp->gapend - n], &rsp->buf[pos],
+		    (size_t)n * sizeof(*rsp->buf));
+		rsp->gap -= n;
+		rsp->gapend -= n;
+	} else if (pos > rsp->gap) {
+		n = pos - rsp->gap;
+		if (n > rsp->size - rsp->gapend)
+			GIVE_UP();
+		memmove(&rsp->buf[rsp->gap], &rsp->buf[rsp->gapend],
+		    (size_t)n * sizeof(*rsp->buf));
+		rsp->gap += n;
+		rsp->gapend += n;
+	}
+}
+
+/*
+ * The rest of a "---" or "+++" line, naming rp.
+ */
+static void
+patch_printname(struct revnode *rp) {
+	out_text(rp->rcsp->shortfname.start, rp->rcsp->shortfname.len, 0);
+	out_char('\t');
+	out_date(&rp->info->date);
+	out_char('\t');
+	out_text(rp->info->revtext.start, rp->info->revtext.len, 0);
+	out_char('\n');
+}
+
+/*
+ * Print lines from to to-1 of opp, each after prefix.
+ */
+static void
+patch_printop(struct rcspatch_op *opp, long from, long to,
+    const char *prefix) {
+	struct piecepos pos;
+	long i;
+
+	if (opp->textp != NULL) {
+		for (i = from; i < to; i++) {
+			out_str(prefix);
+			textprint(&opp->textp[i]);
+		}
+		return;
+	}
+
+	pos = opp->pos;
+	pt_skip(&pos, from);
+	for (i = from; i < to; i++) {
+		out_str(prefix);
+		textprint(pt_next(&pos));
 	}
 }
 
 static void
 reversepatch(struct rcspatch *pp) {
 	struct rcspatch_op *opp;
-	int i, l;
+	long i;
+	int l;
 
 	for (i = 0; i < pp->len; i++) {
 		opp = &pp->op[i];
@@ -922,78 +1694,162 @@ reversepatch(struct rcspatch *pp) {
 
 static struct rcspatch *
 makepatch(struct revnode *revp) {
-	struct rcstext *textp;
-	struct textlist *plist;
 	struct rcspatch *pp;
-	int nline, oline;
 
 	if (revp->patchprev == NULL)
 		return NULL;
 
 	rev_addref(revp->patchprev);
 	rev_addref(revp);
-	rev_calc(revp->patchprev);
-	plist = revp->patchprev->outputlines;
-	pp = patch_create();
+	if (revp->patchprev->info->outputlines == NULL)
+		rev_calc(revp->patchprev);
+	pp = patch_build(revp, revp->patchprev->info->outputlines);
 	pp->oldnode = revp->patchprev;
 	pp->newnode = revp;
+	return pp;
+}
+
+/*
+ * Split the text of revp into lines and, if it is a delta, parse its
+ * commands into revp->info->script, once, so that building the revision
+ * again costs only the copying.  The commands are counted first, so that
+ * the script is allocated at its full size.
+ */
+static void
+rev_loadscript(struct revnode *revp) {
+	struct rcsfile *rcsp = revp->rcsp;
+	struct revinfo *rip = revp->info;
+	struct rcstext *textp, *end;
+	struct edcmd *ecp, cmd;
+	long n;
+
+	if (rip->textlines != NULL)
+		return;
+	rev_loadtext(revp);
+	rip->textlines = textsplit(&rip->text, rcsp->arena);
+	if (revp->patchprev == NULL)
+		return;
+
+	end = &rip->textlines->list[rip->textlines->len];
+	n = 0;
+	for (textp = rip->textlines->list; textp < end; textp++, n++)
+		textp += edcmd_parse(textp, end, &cmd);
+	rip->script = arena_alloc(rcsp->arena, (size_t)n * sizeof(cmd));
+	rip->scriptlen = n;
+
+	ecp = rip->script;
+	for (textp = rip->textlines->list; textp < end; textp++, ecp++) {
+		ecp->text = (long)(textp + 1 - rip->textlines->list);
+		textp += edcmd_parse(textp, end, ecp);
+	}
+}
+
+/*
+ * Parse the command at textp into *ecp, all but its text, returning the
+ * number of lines which follow it, to be added.
+ */
+static long
+edcmd_parse(struct rcstext *textp, struct rcstext *end, struct edcmd *ecp) {
+	const char *p = textp->start;
+	char *q;
+
+	/* XXX check for parse errors */
+	ecp->op = *p++;
+	ecp->line = (long)strtoul(p, &q, 10) - 1;
+	ecp->count = (long)strtoul(q, &q, 10);
+	if (ecp->op != 'a')
+		return 0;
+	if (ecp->count < 0 || ecp->count >= end - textp)
+		GIVE_UP();
+	return ecp->count;
+}
+
+/*
+ * Turn the delta of revp, which rev_loadscript() has parsed, into ops on
+ * plist, the lines of the revision it is patched from.
+ */
+static struct rcspatch *
+patch_build(struct revnode *revp, struct piecetable *plist) {
+	struct revinfo *rip = revp->info;
+	struct edcmd *ecp;
+	struct piecepos pos;
+	struct rcspatch *pp;
+	long nline, oline;
+
+	if (plist->nlines > INT_MAX)
+		patch_toobig(revp);
+	pp = patch_create();
 
 	oline = 0;
 	nline = 0;
-	TEXTLIST_FOREACH(revp->textlines, textp) {
-		const char *p = textp->start;
-		char *q;
-		char op;
-		int arg1, arg2;
-
-		/* XXX check for parse errors */
-		op = *p++;
-		arg1 = (int)strtoul(p, &q, 10) - 1;
-		arg2 = (int)strtoul(q, &q, 10);
+	pos.pc = NULL;
+	for (ecp = rip->script; ecp < &rip->script[rip->scriptlen]; ecp++) {
+		long arg1 = ecp->line;
+		long arg2 = ecp->count;
 
 		/* Convert 'insert-after' semantics to 'insert-before' */
-		if (op == 'a' && oline <= arg1)
+		if (ecp->op == 'a' && oline <= arg1)
 			arg1++;
 
 		if (oline < arg1) {
+			pt_seek(plist, &pos, oline);
 			patch_add(pp, RPOP_COPY, oline, nline, arg1 - oline,
-			    &plist->list[oline]);
+			    NULL, &pos);
 			nline += arg1 - oline;
 			oline += arg1 - oline;
 
-			if (oline > plist->len || textp >
-			    &revp->textlines->list[revp->textlines->len])
+			if (oline > plist->nlines)
 				GIVE_UP();
+			if (nline > INT_MAX)
+				patch_toobig(revp);
 		}
 
 		/* Always start a patch with a RPOP_COPY section */
-		if (oline == 0)
-			patch_add(pp, RPOP_COPY, 0, 0, 0, &plist->list[0]);
+		if (oline == 0) {
+			pt_seek(plist, &pos, 0);
+			patch_add(pp, RPOP_COPY, 0, 0, 0, NULL, &pos);
+		}
 
-		switch(op) {
+		switch(ecp->op) {
 		case 'd':
-			patch_add(pp, RPOP_DEL, arg1, nline, arg2,
-			    &plist->list[arg1]);
+			if (arg1 < 0 || arg1 + arg2 > plist->nlines)
+				GIVE_UP();
+			pt_seek(plist, &pos, arg1);
+			patch_add(pp, RPOP_DEL, arg1, nline, arg2, NULL, &pos);
 			oline += arg2;
-			if (oline > plist->len)
+			if (oline > plist->nlines)
 				GIVE_UP();
 			break;
 		case 'a':
-			patch_add(pp, RPOP_ADD, arg1, nline, arg2, textp + 1);
-			textp += arg2;
+			if (arg2 > INT_MAX - nline)
+				patch_toobig(revp);
+			patch_add(pp, RPOP_ADD, arg1, nline, arg2,
+			    &rip->textlines->list[ecp->text], NULL);
 			nline += arg2;
-			if (oline > plist->len || textp >
-			    &revp->textlines->list[revp->textlines->len])
+			if (oline > plist->nlines)
 				GIVE_UP();
 			break;
 		}
 	}
 	/* Add a final RPOP_COPY section, even if it has zero lines */
-	patch_add(pp, RPOP_COPY, oline, nline, plist->len - oline,
-	    &plist->list[oline]);
+	if (plist->nlines - oline > INT_MAX - nline)
+		patch_toobig(revp);
+	pt_seek(plist, &pos, oline);
+	patch_add(pp, RPOP_COPY, oline, nline, plist->nlines - oline, NULL,
+	    &pos);
 	return pp;
 }
 
+/*
+ * The ops keep line numbers in an int.
+ */
+static void
+patch_toobig(struct revnode *revp) {
+	diag_fatal(revp->rcsp->diag, "%s: %.*s: more than %d lines",
+	    revp->rcsp->filename, (int)revp->info->revtext.len,
+	    revp->info->revtext.start, INT_MAX);
+}
+
 static struct rcspatch *
 patch_create(void) {
 	struct rcspatch *pp;
@@ -1019,8 +1875,8 @@ patch_destroy(struct rcspatch *pp) {
 }
 
 static void
-patch_add(struct rcspatch *pp, int op, int line, int nline, int len,
-    struct rcstext *textp) {
+patch_add(struct rcspatch *pp, int op, long line, long nline, long len,
+    struct rcstext *textp, const struct piecepos *pos) {
 	struct rcspatch_op *opp;
 
 	if (pp->len == pp->op_len) {
@@ -1030,73 +1886,26 @@ patch_add(struct rcspatch *pp, int op, int line, int nline, int len,
 
 	opp = &pp->op[pp->len++];
 	opp->op = op;
-	opp->line = line;
-	opp->nline = nline;
-	opp->len = len;
+	opp->line = (int)line;
+	opp->nline = (int)nline;
+	opp->len = (int)len;
 	opp->textp = textp;
+	if (pos != NULL)
+		opp->pos = *pos;
 }
 
 static int
 id_lookup(struct rcstext *id) {
-	if (id->start == NULL)
+	const unsigned char *p = (const unsigned char *)id->start;
+	const struct keyword *kp;
+
+	if (p == NULL || id->len < KEYWORD_MINLEN || id->len > KEYWORD_MAXLEN)
 		return ID_NONE;
-	switch (*id->start) {
-	case 'a':
-		if (txtequ(id, &id_access))
-			return ID_ACCESS;
-		if (txtequ(id, &id_author))
-			return ID_AUTHOR;
-		break;
-	case 'b':
-		if (txtequ(id, &id_branch))
-			return ID_BRANCH;
-		if (txtequ(id, &id_branches))
-			return ID_BRANCHES;
-		break;
-	case 'c':
-		if (txtequ(id, &id_comment))
-			return ID_COMMENT;
-		if (txtequ(id, &id_commitid))
-			return ID_COMMITID;
-		break;
-	case 'd':
-		if (txtequ(id, &id_date))
-			return ID_DATE;
-		if (txtequ(id, &id_desc))
-			return ID_DESC;
-		break;
-	case 'e':
-		if (txtequ(id, &id_expand))
-			return ID_EXPAND;
-		break;
-	case 'h':
-		if (txtequ(id, &id_head))
-			return ID_HEAD;
-		break;
-	case 'l':
-		if (txtequ(id, &id_locks))
-			return ID_LOCKS;
-		if (txtequ(id, &id_log))
-			return ID_LOG;
-		break;
-	case 'n':
-		if (txtequ(id, &id_next))
-			return ID_NEXT;
-		break;
-	case 's':
-		if (txtequ(id, &id_state))
-			return ID_STATE;
-		if (txtequ(id, &id_strict))
-			return ID_STRICT;
-		if (txtequ(id, &id_symbols))
-			return ID_SYMBOLS;
-		break;
-	case 't':
-		if (txtequ(id, &id_text))
-			return ID_TEXT;
-		break;
-	}
-	return ID_NONE;
+	kp = &keywords[KEYWORD_HASH(p, id->len)];
+	if (kp->name.len != id->len ||
+	    memcmp(kp->name.start, p, (size_t)id->len) != 0)
+		return ID_NONE;
+	return kp->id;
 }
 
 
@@ -1114,10 +1923,13 @@ optional_tok(struct parser *pp, struct token *tokp, int type) {
 static void
 expect_tok(struct parser *pp, struct token *tokp, int type) {
 	if (!gettok(pp, tokp))
-		errx(1, "expect_tok(%s): EOF", tokname[type]);
+		diag_fatal(pp->rcsp->diag, "expect_tok(%s): EOF",
+		    tokname[type]);
 	if (tokp->type != type)
-		errx(1, "expect_tok(%s): got %s['%.*s']", tokname[type],
-		    tokname[tokp->type], tokp->value.len, tokp->value.start);
+		diag_fatal(pp->rcsp->diag, "expect_tok(%s): got %s['%.*s']",
+		    tokname[type],
+		    tokname[tokp->type], (int)tokp->value.len,
+		    tokp->value.start);
 }
 
 void
@@ -1129,8 +1941,8 @@ puttok(struct parser *pp, struct token *tokp) {
 
 static int
 gettok(struct parser *pp, struct token *tokp) {
-	char *p, *end;
-	const char *p1;
+	const char *p, *end;
+	int isnum;
 
 	if (pp->saved.type != TOKTYPE_NONE) {
 		*tokp = pp->saved;
@@ -1139,32 +1951,19 @@ gettok(struct parser *pp, struct token *tokp) {
 	}
 
 	tokp->type = TOKTYPE_NONE;
-	p = pp->pos;
 	end = pp->end;
+	p = pp->scan->space(pp->pos, end);
 
-	while (p < end) {
+	if (p < end) {
 		switch (*p) {
-		case ' ': case '\b': case '\t': case '\n':
-		case '\002': case '\f': case '\r':
-			p++;
-			continue;
-
 		case '@':
 			p++;
 			tokp->value.start = p;
-
-			for (;;) {
-				if ((p = memchr(p, '@', (size_t)(end - p))) == NULL)
-					errx(1, "no matching '@'");
-				if (p + 1 < end && p[1] == '@') {
-					p += 2;
-					continue;
-				}
-				tokp->value.len = (int)(p - tokp->value.start);
-				tokp->type = TOKTYPE_STRING;
-				p++;
-				break;
-			}
+			if ((p = pp->scan->string(p, end)) == NULL)
+				diag_fatal(pp->rcsp->diag, "no matching '@'");
+			tokp->value.len = (long)(p - tokp->value.start);
+			tokp->type = TOKTYPE_STRING;
+			p++;
 			goto done;
 
 		case ':':
@@ -1181,29 +1980,10 @@ gettok(struct parser *pp, struct token *tokp) {
 		}
 
 		tokp->value.start = p;
-		while (p < end) {
-			switch (*p) {
-			default:
-				p++;
-				continue;
-
-			case ' ': case '\b': case '\t': case '\n':
-			case '\002': case '\f': case '\r':
-			case ':': case ';':
-				break;
-			}
-			break;
-		}
-		tokp->value.len = (int)(p - tokp->value.start);
-
-		tokp->type = TOKTYPE_NUM;
-		for (p1 = tokp->value.start; p1 < p; p1++) {
-			if ((*p1 < '0' || *p1 > '9') && *p1 != '.') {
-				tokp->type = TOKTYPE_ID;
-				break;
-			}
-		}
-		goto done;
+		isnum = 1;
+		p = pp->scan->word(p, end, &isnum);
+		tokp->value.len = (long)(p - tokp->value.start);
+		tokp->type = isnum ? TOKTYPE_NUM : TOKTYPE_ID;
 	}
 
 done:
@@ -1211,13 +1991,75 @@ done:
 	return (tokp->type != TOKTYPE_NONE);
 }
 
+/*
+ * The sort key packs the date into the bits below SORTKEY_VALID, and the
+ * rank of the filename into the low SORTKEY_RANKBITS, so that comparing
+ * keys orders revisions the same way as comparing their dates, newest
+ * first, and then their filenames.  Dates whose fields don't fit get no
+ * key (0), and are compared the long way.
+ */
+#define SORTKEY_VALID		((uint64_t)1 << 63)
+#define SORTKEY_RANKBITS	24
+#define SORTKEY_DATEBITS	39
+
+static uint64_t
+datekey(const struct rcsnum *date) {
+	static const int bits[] = {13, 4, 5, 5, 6, 6};
+	uint64_t key = 0;
+	int i;
+
+	if (date->len != 6)
+		return 0;
+	for (i = 0; i < 6; i++) {
+		if (date->num[i] < 0 || date->num[i] >= (1 << bits[i]))
+			return 0;
+		key = (key << bits[i]) | (uint64_t)date->num[i];
+	}
+	key = (((uint64_t)1 << SORTKEY_DATEBITS) - 1) - key;
+	return SORTKEY_VALID | (key << SORTKEY_RANKBITS);
+}
+
+/*
+ * Sort the revisions of one file, which has been given its rank among
+ * the others, in the same order as revbydate(), but mostly by comparing
+ * the precomputed keys.  The keys then order the revisions of all the
+ * files.
+ */
+void
+revsort(struct revnode **list, int n) {
+	int i;
+
+	for (i = 0; i < n; i++) {
+		struct revnode *revp = list[i];
+
+		if (revp->sortkey == 0)
+			continue;
+		revp->sortkey &= ~(((uint64_t)1 << SORTKEY_RANKBITS) - 1);
+		if (revp->rcsp->rank < (1 << SORTKEY_RANKBITS))
+			revp->sortkey |= (uint64_t)revp->rcsp->rank;
+		else
+			revp->sortkey = 0;
+	}
+
+	qsort(list, (size_t)n, sizeof(*list), revbydate);
+}
+
+/*
+ * Order revisions newest first, and then by filename.  The keys can be
+ * compared only between revisions of one file, or of files which have
+ * been ranked by name, as revsort() expects.
+ */
 int
 revbydate(const void *v1, const void *v2) {
 	const struct revnode *revp1 = *(struct revnode *const *)v1;
 	const struct revnode *revp2 = *(struct revnode *const *)v2;
 	int ret;
 
-	ret = -numcmp(&revp1->date, &revp2->date);
+	if (revp1->sortkey != 0 && revp2->sortkey != 0)
+		return (revp1->sortkey < revp2->sortkey) ? -1 :
+		    (revp1->sortkey > revp2->sortkey);
+
+	ret = -numcmp(&revp1->info->date, &revp2->info->date);
 	if (ret != 0)
 		return ret;
 	ret = strcmp(revp1->rcsp->filename, revp2->rcsp->filename);
@@ -1225,3 +2067,102 @@ revbydate(const void *v1, const void *v2) {
 		return (ret < 0) ? -1 : 1;
 	return 0;
 }
+
+void
+rcsdiag_init(struct rcsdiag *diag) {
+	diag->out = sb_create();
+	diag->err = sb_create();
+	diag->fatal = 0;
+}
+
+/*
+ * Print what was saved in diag, as it would have been printed had the
+ * file been opened without one, and exit if there was a fatal error.
+ */
+void
+rcsdiag_replay(struct rcsdiag *diag) {
+	char *p, *end;
+
+	out_write(sb_ptr(diag->out), (size_t)sb_len(diag->out));
+	sb_reset(diag->out);
+
+	p = sb_ptr(diag->err);
+	end = p + sb_len(diag->err);
+	while (p < end) {
+		char *next = p + strlen(p) + 1;
+
+		if (next == end && diag->fatal)
+			errx(1, "%s", p);
+		warnx("%s", p);
+		p = next;
+	}
+	sb_reset(diag->err);
+}
+
+void
+rcsdiag_free(struct rcsdiag *diag) {
+	sb_free(diag->out);
+	sb_free(diag->err);
+}
+
+static void
+diag_printf(struct rcsdiag *diag, const char *fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (diag == NULL)
+		out_vprintf(fmt, ap);
+	else
+		sb_vappendf(diag->out, fmt, ap);
+	va_end(ap);
+}
+
+static void
+diag_warn(struct rcsdiag *diag, const char *fmt, ...) {
+	va_list ap;
+	int serrno = errno;
+
+	va_start(ap, fmt);
+	if (diag == NULL) {
+		errno = serrno;
+		vwarn(fmt, ap);
+	} else {
+		sb_vappendf(diag->err, fmt, ap);
+		sb_appendf(diag->err, ": %s", strerror(serrno));
+		sb_appendchar(diag->err, '\0');
+	}
+	va_end(ap);
+}
+
+static void
+diag_warnx(struct rcsdiag *diag, const char *fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (diag == NULL)
+		vwarnx(fmt, ap);
+	else {
+		sb_vappendf(diag->err, fmt, ap);
+		sb_appendchar(diag->err, '\0');
+	}
+	va_end(ap);
+}
+
+/*
+ * Report an error after which the file can't be used.  This does not
+ * return.
+ */
+static void
+diag_fatal(struct rcsdiag *diag, const char *fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (diag == NULL)
+		verrx(1, fmt, ap);
+	sb_vappendf(diag->err, fmt, ap);
+	sb_appendchar(diag->err, '\0');
+	va_end(ap);
+
+	diag->fatal = 1;
+	longjmp(diag->env, 1);
+}
@@ -27,46 +27,154 @@
 #ifndef RCSFILE_H
 #define RCSFILE_H
 
+#include <sys/types.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <time.h>
+
 #include "misc.h"
 #include "namedobjlist.h"
+#include "strbuf.h"
+#include "scan.h"
 
+/*
+ * A revision is split in two.  The revnode holds what sorting and the
+ * walks along branches look at; the revinfo holds the rest.  Each file
+ * keeps its revnodes in blocks of REVBLK, in the order they were created,
+ * and the revinfos in parallel blocks, so that a pass over the revnodes
+ * reads dense memory.
+ */
 struct revnode {
 	struct rcsfile *rcsp;
+	struct revinfo *info;
 
-	struct rcstext revtext;
+	uint64_t sortkey;		/* see revbydate() */
 	struct rcsnum rev;
+	int hidden;			/* see struct rcsfilter */
+
+	struct revnode *next;
+	struct revnode *prev;
+	struct revnode *patchnext;
+	struct revnode *patchprev;
+};
+
+struct revinfo {
+	struct rcsnum date;		/* sortkey has it, if it fits */
+	struct rcstext revtext;
 	struct rcstext author;
-	struct rcsnum date;
 	struct rcstext log;
 	struct rcstext text;
 	struct rcstext state;
 	struct rcstext patchnextrev;
 
 	struct textlist *textlines;
-	struct textlist *outputlines;
-	int olrefs;
+	struct edcmd *script;		/* the delta's commands */
+	long scriptlen;
+	struct piecetable *outputlines;
+	int olrefs;			/* see rev_addref() */
+	int cacheslot;			/* see textcache.c */
 
 	struct textlist *branchrevs;
 
 	struct textlist *tags;
-	struct textlist *branches;
 	struct textlist *branchpoints;
+};
 
-	struct revnode *next;
-	struct revnode *prev;
-	struct revnode *patchnext;
-	struct revnode *patchprev;
+/*
+ * One command of a delta, as parsed by rev_loadscript(): delete count
+ * lines from line, or add count lines after it, these being found from
+ * textlines->list[text].  Lines are numbered from 0.
+ */
+struct edcmd {
+	char op;			/* 'a' or 'd' */
+	long line;
+	long count;
+	long text;
 };
 
+/*
+ * A branch which has revisions, found in rcsp->branches by its number
+ * (1.2.2 for the branch starting at 1.2.2.1).  The branch symbols naming
+ * it are kept here once, rather than on each revision; see rev_branches().
+ */
+struct branch {
+	struct revnode *start;		/* first revision on the branch */
+	struct revnode *head;		/* last, once a symbol needs it */
+	struct textlist *symbols;	/* NULL if none */
+};
+
+#define REVBLK_SHIFT	6
+#define REVBLK		(1 << REVBLK_SHIFT)
+
+/* The i'th revision of rcsp, 0 <= i < rcsp->nrevs */
+#define REVNODE(rcsp, i) \
+	(&(rcsp)->revblk[(i) >> REVBLK_SHIFT][(i) & (REVBLK - 1)])
+
+
+struct token {
+	int type;
+	struct rcstext value;
+};
+
+#define TOKTYPE_NONE	0
+#define TOKTYPE_NUM	1
+#define TOKTYPE_ID	2
+#define TOKTYPE_STRING	3
+#define TOKTYPE_COLON	4
+#define TOKTYPE_SEMI	5
+
+struct parser {
+	const char *pos;
+	const char *end;
+	const struct scanner *scan;
+	struct rcsfile *rcsp;
+
+	struct token saved;
+};
+
+/*
+ * Collects what a parse would have printed, so that files can be opened
+ * away from the main thread and their messages replayed in order later.
+ * A fatal error longjmps to env instead of exiting.
+ */
+struct rcsdiag {
+	Strbuf *out;			/* for stdout */
+	Strbuf *err;			/* warnings, each ending in a NUL */
+	int fatal;			/* the last warning is fatal */
+	jmp_buf env;
+};
+
+struct fileid {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	long mtime_nsec;
+	time_t ctime;
+	long ctime_nsec;
+};
+
+/*
+ * Which revisions revlist() leaves out: those before since or after until,
+ * where these have a length, and those by anyone but author, if it is not
+ * NULL.  They are still kept, and made into others.
+ */
+struct rcsfilter {
+	struct rcsnum since;
+	struct rcsnum until;
+	const char *author;
+};
 
 #define RCSFILE_LOWMEM	0x0001	/* Cache less to reduce memory usage */
+#define RCSFILE_NOTEXT	0x0002	/* Logs only, never build revision texts */
 
 struct rcsfile {
 	char *mapstart;
-	int maplen;
+	size_t maplen;
 	char *filename;
 	struct rcstext shortfname;
 	int flags;
+	const struct rcsfilter *filter;	/* or NULL; must outlive the file */
 
 	struct rcstext headrev;
 	struct rcstext branch;
@@ -81,28 +189,27 @@ struct rcsfile {
 	Namedobjlist *symbols;
 	Namedobjlist *revtags;
 	Namedobjlist *branchhead;
+	Namedobjlist *branches;
 	Namedobjlist *revs;
 	Namedobjlist *revsbynum;
 	int nrevs;
-};
+	struct revnode **revblk;	/* see REVNODE() */
+	struct revinfo **infoblk;
+	int nrevblk;			/* room in revblk and infoblk */
 
-struct token {
-	int type;
-	struct rcstext value;
-};
+	struct parser textparse;	/* where to resume reading deltatexts */
+	int textdone;
 
-#define TOKTYPE_NONE	0
-#define TOKTYPE_NUM	1
-#define TOKTYPE_ID	2
-#define TOKTYPE_STRING	3
-#define TOKTYPE_COLON	4
-#define TOKTYPE_SEMI	5
+	struct fileid fileid;		/* key for the parse cache */
+	long cachepos;			/* textparse offset when cached */
 
-struct parser {
-	char *pos;
-	char *end;
+	struct rcsdiag *diag;		/* NULL to report errors directly */
+	int rank;			/* filename order, for sortkey */
+	int nshown;			/* revisions not hidden */
 
-	struct token saved;
+	struct arena *arena;		/* for everything parsed */
+	int nheaplines;			/* outputlines not in the arena */
+	struct textcache *cache;	/* see textcache_split() */
 };
 
 #define ID_NONE		0
@@ -123,33 +230,85 @@ struct parser {
 #define ID_LOG		15
 #define ID_TEXT		16
 #define ID_COMMITID	17
+#define ID_MAX		18
 
+/*
+ * The lines an op covers are at textp if they came from the delta, and
+ * otherwise at pos in the outputlines of the revision patched.  Line
+ * numbers and counts fit in an int, since patch_build() refuses a
+ * revision of more lines.
+ */
 struct rcspatch_op {
 	enum {RPOP_COPY, RPOP_DEL, RPOP_ADD} op;
 	int line;
 	int nline;
 	int len;
 	struct rcstext *textp;
+	struct piecepos pos;
 };
 
 struct rcspatch {
 	struct revnode *oldnode;
 	struct revnode *newnode;
 	struct rcspatch_op *op;
-	int len;
-	int op_len;
+	long len;
+	long op_len;
+};
+
+/*
+ * The patch of a revision, from rev_diffstart() to rev_diffend(): either
+ * the whole of the first revision, or a patch, perhaps to be reversed.
+ */
+struct rcsdiff {
+	struct revnode *whole;
+	struct rcspatch *patch;
+	int reverse;
+};
+
+/*
+ * A walk down one file's trunk, newest first, holding only the lines of
+ * the revision reached; see revstream_diff().
+ */
+struct revstream {
+	struct revnode *cur;		/* whose lines are in buf */
+	struct rcstext *buf;		/* the lines, less a gap */
+	long size;
+	long gap;			/* first slot of the gap */
+	long gapend;			/* first slot after the gap */
+	struct rcspatch_op *op;		/* the ops being applied */
+	long op_len;
 };
 
 struct rcsfile *rcsfile_open(const char *filename);
-struct rcsfile *rcsfile_smartopen(const char *filename, char **branchp);
+struct rcsfile *rcsfile_openflags(const char *filename, int flags);
+struct rcsfile *rcsfile_opendiag(const char *filename, int flags,
+    const struct rcsfilter *filter, struct rcsdiag *diag);
+struct rcsfile *rcsfile_smartopen(const char *filename, char **branchp,
+    int flags);
+char *rcsfile_findpath(const char *filename, char **branchp);
 void rcsfile_free(struct rcsfile *rcsp);
 void rcsfile_setflags(struct rcsfile *rcsp, int flags);
+struct revnode *rev_create(struct rcsfile *rcsp, struct rcstext *revtext);
 struct revnode **revlist(struct rcsfile *rcsp, char *branch);
+void rev_loadtext(struct revnode *revp);
 void rev_calc(struct revnode *revp);
 void rev_diff(struct revnode *revp, int ctx, int reverse);
+void rev_diffstart(struct revnode *revp, int reverse, struct rcsdiff *dp);
+void rev_diffprint(struct rcsdiff *dp, int ctx);
+void rev_diffend(struct rcsdiff *dp);
+void rev_diffstat(struct revnode *revp, long *addp, long *delp);
 void rev_addref(struct revnode *revp);
 void rev_remref(struct revnode *revp);
+struct textlist *rev_branches(struct revnode *revp);
+int revstream_ok(struct revnode **list, int n);
+struct revstream *revstream_create(struct revnode *head);
+void revstream_diff(struct revstream *rsp, struct revnode *revp, int ctx);
+void revstream_free(struct revstream *rsp);
 int revbydate(const void *v1, const void *v2);
+void revsort(struct revnode **list, int n);
+void rcsdiag_init(struct rcsdiag *diag);
+void rcsdiag_replay(struct rcsdiag *diag);
+void rcsdiag_free(struct rcsdiag *diag);
 
 
 
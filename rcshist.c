@@ -26,29 +26,239 @@
  */
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <ctype.h>
 #include <err.h>
-#include <fts.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <unistd.h>
 
 #include "rcshist.h"
 #include "namedobjlist.h"
 #include "rcsfile.h"
+#include "rcscache.h"
+#include "textcache.h"
+#include "outbuf.h"
+#include "walk.h"
 #include "misc.h"
 
-void filelist_expand(char ***filelistp, int *nfilesp);
-int filelist_ftscmp(const FTSENT * *fe1, const FTSENT * *fe2);
-void prrev(struct revnode *revp);
+void prrev(struct revnode *revp, pthread_mutex_t *lock);
 void prlist(const char *prefix, struct textlist *tlp);
 void prlog(struct revnode *revp);
 void onerev(char *filename, char *revame);
 
+/*
+ * The revisions of all the files are shown newest first by merging the
+ * sorted lists of each, always taking the next from the file whose next
+ * revision is the newest, so nothing waits for a sort of them all.  A
+ * file is closed once all its revisions have been shown, and no more than
+ * MERGE_MAXOPEN are kept open: when another must be opened, the open one
+ * whose next revision is furthest off is closed, keeping only the key of
+ * that revision, and opened again when it is reached.  That means reading
+ * it again, which is cheap for the small files making up most of a big
+ * tree.  Files are closed only between batches of MERGE_BATCH revisions,
+ * once what was taken from them has been shown, which with -j may be
+ * some batches later.
+ *
+ * With --limit, the merge stops after that many revisions.  The keys of
+ * the newest that many seen so far, over the files opened, are kept in
+ * a heap with the oldest of them on top, and a file whose newest
+ * revision is older than that is dropped as soon as it has been opened.
+ */
+#define MERGE_MAXOPEN	1024
+#define MERGE_BATCH	256
+
+/*
+ * What places a revision among those of all the files, kept apart from
+ * the revision so that its file may be closed.
+ */
+struct revkey {
+	uint64_t sortkey;		/* see revbydate() */
+	struct rcsnum date;
+	const char *path;
+	int index;
+};
+
+struct mfile {
+	const char *name;		/* as given or found */
+	char *path;
+	char *branch;
+	int index;			/* in the file list */
+	int rank;			/* by path, for the sort keys */
+	int opened;			/* it could be read */
+	struct rcsfile *rcsp;		/* NULL while closed */
+	struct revnode **list;		/* its revisions, sorted */
+	int nrevs;
+	int next;			/* the next of list to show */
+	int closing;			/* once shown */
+	int listed;			/* in merge->closing */
+	int last;			/* taken of its last revision */
+	struct revkey key;		/* of list[next] */
+};
+
+struct merge {
+	struct mfile *files;
+	int nfiles;
+	int flags;
+	const struct rcsfilter *filter;
+	int ngroups;			/* see struct renderpool */
+	struct renderpool *render;	/* theirs, while they run */
+	struct mfile **heap;		/* heap[0] has the newest revision */
+	int nheap;
+	int nopen;			/* and not closing */
+	struct mfile **closing;		/* to close when shown */
+	int nclosing;
+	int limit;			/* from --limit, or 0 */
+	int taken;			/* revisions so far */
+	struct revkey **top;		/* top[0] is the oldest of the newest */
+	int ntop;
+	int top_len;
+};
+
+static void merge_rank(struct mfile *files, int nfiles);
+static void merge_add(struct merge *mp, struct mfile *mfp);
+static int merge_top(struct merge *mp, struct mfile *mfp);
+static int merge_next(struct merge *mp, struct revnode **out, int max);
+static void merge_release(struct merge *mp);
+static void merge_reopen(struct merge *mp, struct mfile *mfp);
+static void merge_evict(struct merge *mp, struct mfile *except);
+static int revkey_cmp(const struct revkey *k1, const struct revkey *k2);
+static void revkey_set(struct revkey *kp, struct revnode *revp,
+    struct mfile *mfp);
+static int mfilebypath(const void *v1, const void *v2);
+static void heap_up(struct merge *mp, int i);
+static void heap_down(struct merge *mp, int i);
+
+/*
+ * With -j, the files are opened and their revision lists built by a pool
+ * of threads.  Each job has its own branch, since CVS/Tag may set it part
+ * way through the list, and its own diagnostics, which are replayed in
+ * file order so that the output is the same as for a serial run.
+ */
+struct ingest {
+	const char *path;
+	char *branch;
+	int flags;
+	const struct rcsfilter *filter;
+	struct rcsfile *rcsp;
+	struct revnode **rlist;
+	struct rcsdiag diag;
+};
+
+#define INGEST_BLK	256
+
+struct ingestpool {
+	struct ingest **blk;		/* the jobs, INGEST_BLK to a block */
+	int nblk;
+	int njobs;
+	int next;
+	int closed;			/* no more jobs to come */
+	int flags;
+	const struct rcsfilter *filter;
+	pthread_t *threads;
+	int nthreads;
+	pthread_mutex_t lock;
+	pthread_cond_t added;		/* a job, or closed */
+};
+
+#define INGEST_JOB(pool, i) \
+	(&(pool)->blk[(i) / INGEST_BLK][(i) % INGEST_BLK])
+
+/*
+ * With -j, the revisions of several files are also shown by a pool of
+ * threads, started once.  The main thread hands them the revisions in
+ * order, through a ring of RENDER_WINDOW slots; each thread takes the
+ * next, whatever its file, and renders it into the slot's buffer, and the
+ * main thread writes out each run of slots done, in order, as it needs
+ * them back.  What is kept for a file, its delta texts, output lines and
+ * their reference counts, is built under the lock of its group, the files
+ * whose rank is the same modulo the number of groups, which also share
+ * one text cache.  There are as many groups as threads, unless there are
+ * fewer files.
+ */
+#define RENDER_WINDOW	256
+
+struct renderpool {
+	struct revnode *rev[RENDER_WINDOW];
+	struct outbuf *out[RENDER_WINDOW];
+	int done[RENDER_WINDOW];
+	int nrevs;			/* revisions handed in */
+	int next;			/* the next to render */
+	int emitted;			/* and written out */
+	int closed;			/* no more to come */
+	pthread_mutex_t *group;		/* a lock for each group of files */
+	int ngroups;
+	pthread_t *threads;
+	int nthreads;
+	pthread_mutex_t lock;
+	pthread_cond_t added;		/* a revision, or closed */
+	pthread_cond_t filled;		/* a slot is done */
+};
+
+static struct ingestpool *ingest_start(int flags,
+    const struct rcsfilter *filter, int nthreads);
+static void ingest_add(struct ingestpool *pool, const char *path,
+    char *branch);
+static void ingest_finish(struct ingestpool *pool);
+static void *ingest_worker(void *arg);
+static void ingest_one(struct ingest *job);
+static struct rcsfile *ingest_result(struct ingestpool *pool, int i,
+    struct revnode ***rlistp);
+static void ingest_free(struct ingestpool *pool);
+static struct renderpool *render_start(int nthreads, int ngroups);
+static void render_add(struct renderpool *pool, struct revnode **list,
+    int n);
+static void render_emit(struct renderpool *pool);
+static void render_finish(struct renderpool *pool);
+static void *render_worker(void *arg);
+static size_t parse_size(const char *s);
+static void parse_date(const char *s, struct rcsnum *np, int end);
+static void prstat(struct rcstext *name, long add, long del);
+static void prtotals(struct mfile *files, int nfiles);
+
+/*
+ * With --stat or --numstat, the lines added and deleted are shown instead
+ * of each patch, and added up for each file.
+ */
+#define STAT_NONE	0
+#define STAT_STAT	1
+#define STAT_NUM	2
+
+#define OPT_STAT	256
+#define OPT_NUMSTAT	257
+#define OPT_SINCE	258
+#define OPT_UNTIL	259
+#define OPT_AUTHOR	260
+#define OPT_LIMIT	261
+#define OPT_SORTED	262
+
+static const struct option longopts[] = {
+	{"stat", no_argument, NULL, OPT_STAT},
+	{"numstat", no_argument, NULL, OPT_NUMSTAT},
+	{"since", required_argument, NULL, OPT_SINCE},
+	{"until", required_argument, NULL, OPT_UNTIL},
+	{"author", required_argument, NULL, OPT_AUTHOR},
+	{"limit", required_argument, NULL, OPT_LIMIT},
+	{"sorted", no_argument, NULL, OPT_SORTED},
+	{NULL, 0, NULL, 0}
+};
+
+struct filestat {
+	long add;
+	long del;
+	int shown;			/* in the totals */
+};
+
 char *progname;
+int lflag;
 int mflag;
+int statmode;
+struct filestat *fstats;	/* by rcsp->rank */
+struct revstream *stream;	/* for a single file's trunk */
 
 void
 give_up(const char *fn, int ln)
 {
-	fflush(stdout);
+	out_flush();
 	fprintf(stderr, "%s: fatal error at %s line %d\n", progname, fn, ln);
 	exit(EXIT_FAILURE);
 }
@@ -56,29 +266,60 @@ give_up(const char *fn, int ln)
 static void
 usage(void) {
 	fprintf(stderr,
-	    "Usage: %s [-mR] [-r<branch|MAIN|ALL>] <filename> ...\n"
-	    "       %s -L<revision> <filename>\n",
-	    progname, progname);
+	    "Usage: %s [-lmR] [-C<cachedir>] [-j<jobs>] [-M<size>] "
+	    "[-r<branch|MAIN|ALL>]\n"
+	    "       %*s [--stat|--numstat] [--since <date>] [--until <date>]\n"
+	    "       %*s [--author <login>] [--limit <n>] [--sorted]\n"
+	    "       %*s <filename> ...\n"
+	    "       %s [-l] [-C<cachedir>] -L<revision> <filename>\n",
+	    progname, (int)strlen(progname), "", (int)strlen(progname), "",
+	    (int)strlen(progname), "", progname);
 	exit(1);
 }
 
 int
 main(int argc, char **argv) {
-	struct rcsfile **rcsp;
-	int ch, i, nfiles;
+	struct mfile *files, *mfp;
+	struct merge merge;
+	struct ingestpool *pool;
+	struct walk *walk;
+	struct rcsfile *rcsp;
+	int ch, i, n, nfiles, files_len;
+	const char *name;
 	char *branch = NULL;
 	char *revname = NULL;
 	char **filelist;
-	struct revnode **rlist, **rltmp;
-	int Rflag, rnum, rlist_len;
+	char *ep;
+	struct revnode **rlist, *batch[MERGE_BATCH];
+	struct rcsfilter filter;
+	int Rflag, sorted, flags, jobs, limit;
 
 	progname = argv[0];
 	Rflag = 0;
-	while ((ch = getopt(argc, argv, "L:mr:R")) != -1) {
+	sorted = 0;
+	jobs = 1;
+	limit = 0;
+	bzero(&filter, sizeof(filter));
+	while ((ch = getopt_long(argc, argv, "C:j:L:lM:mr:R", longopts,
+	    NULL)) != -1) {
 		switch (ch) {
+		case 'C':
+			rcscache_setdir(optarg);
+			break;
+		case 'j':
+			jobs = (int)strtol(optarg, &ep, 10);
+			if (*ep != '\0' || jobs < 1)
+				usage();
+			break;
 		case 'L':
 			revname = optarg;
 			break;
+		case 'l':
+			lflag = 1;
+			break;
+		case 'M':
+			textcache_setbudget(parse_size(optarg));
+			break;
 		case 'm':
 			mflag = 1;
 			break;
@@ -88,6 +329,29 @@ main(int argc, char **argv) {
 		case 'R':
 			Rflag = 1;
 			break;
+		case OPT_STAT:
+			statmode = STAT_STAT;
+			break;
+		case OPT_NUMSTAT:
+			statmode = STAT_NUM;
+			break;
+		case OPT_SINCE:
+			parse_date(optarg, &filter.since, 0);
+			break;
+		case OPT_UNTIL:
+			parse_date(optarg, &filter.until, 1);
+			break;
+		case OPT_AUTHOR:
+			filter.author = optarg;
+			break;
+		case OPT_SORTED:
+			sorted = 1;
+			break;
+		case OPT_LIMIT:
+			limit = (int)strtol(optarg, &ep, 10);
+			if (*ep != '\0' || limit < 1)
+				usage();
+			break;
 		case '?':
 		default:
 			usage();
@@ -107,75 +371,965 @@ main(int argc, char **argv) {
 		exit(0);
 	}
 
+	walk = NULL;
 	if (Rflag)
-		filelist_expand(&filelist, &nfiles);
+		walk = walk_start(filelist, nfiles, jobs,
+		    sorted ? WALK_SORTED : 0);
+
+	flags = 0;
+	if (lflag)
+		flags |= RCSFILE_NOTEXT;
+	if (mflag && textcache_budget() == 0)
+		flags |= RCSFILE_LOWMEM;
+
+	/*
+	 * Work out the paths first, in order, since that may set branch,
+	 * and rank them.  With -j, each file is handed to the pool as soon
+	 * as its path is known, so with -R the first are being read while
+	 * the rest are looked for.
+	 */
+	pool = NULL;
+	if (jobs > 1 && (Rflag || nfiles > 1))
+		pool = ingest_start(flags, &filter, jobs);
+	files = NULL;
+	files_len = 0;
+	for (i = 0; ; i++) {
+		if (walk != NULL)
+			name = walk_next(walk);
+		else
+			name = (i < nfiles) ? filelist[i] : NULL;
+		if (name == NULL)
+			break;
+		if (i == files_len) {
+			files_len += files_len + 64;
+			files = realloc(files, (size_t)files_len *
+			    sizeof(*files));
+		}
+		mfp = &files[i];
+		bzero(mfp, sizeof(*mfp));
+		mfp->name = name;
+		mfp->path = rcsfile_findpath(name, &branch);
+		mfp->branch = (branch == NULL) ? NULL : strdup(branch);
+		mfp->index = i;
+		if (pool != NULL)
+			ingest_add(pool, mfp->path, mfp->branch);
+	}
+	nfiles = i;
+	if (pool != NULL)
+		ingest_finish(pool);
+	merge_rank(files, nfiles);
+
+	bzero(&merge, sizeof(merge));
+	merge.files = files;
+	merge.nfiles = nfiles;
+	merge.flags = flags;
+	merge.filter = &filter;
+	merge.limit = limit;
+	merge.heap = malloc((size_t)nfiles * sizeof(*merge.heap));
+	merge.closing = malloc((size_t)nfiles * sizeof(*merge.closing));
+	if (jobs > 1 && nfiles > 0) {
+		merge.ngroups = (jobs < nfiles) ? jobs : nfiles;
+		if (merge.ngroups > 1)
+			textcache_split(merge.ngroups);
+	}
 
-	rlist = NULL;
-	rnum = 0;
-	rlist_len = 0;
+	for (i = 0; i < nfiles; i++) {
+		mfp = &files[i];
+		if (pool != NULL) {
+			if ((rcsp = ingest_result(pool, i, &rlist)) == NULL)
+				continue;
+		} else {
+			if ((rcsp = rcsfile_opendiag(mfp->path, flags, &filter,
+			    NULL)) == NULL)
+				continue;
+			rlist = revlist(rcsp, mfp->branch);
+		}
+		if (rcsp->nshown == 0) {
+			/* Nothing it has passes --since, --until or --author */
+			free(rlist);
+			rcsfile_free(rcsp);
+			continue;
+		}
+		mfp->opened = 1;
+		mfp->rcsp = rcsp;
+		if (rlist == NULL) {
+			warnx("%s: %s: no such branch\n", mfp->name,
+			    argv[2]);
+			rcsfile_free(rcsp);
+			mfp->rcsp = NULL;
+			continue;
+		}
+		mfp->list = rlist;
+		merge_add(&merge, mfp);
+		merge_release(&merge);
+	}
+	if (pool != NULL)
+		ingest_free(pool);
+	if (walk != NULL)
+		walk_free(walk);
+
+	if (statmode != STAT_NONE)
+		fstats = calloc((size_t)nfiles, sizeof(*fstats));
+	else if (nfiles == 1 && !lflag && files[0].list != NULL &&
+	    revstream_ok(files[0].list, files[0].nrevs))
+		stream = revstream_create(files[0].list[0]);
+	if (merge.ngroups > 0 && stream == NULL)
+		merge.render = render_start(jobs, merge.ngroups);
+	while ((n = merge_next(&merge, batch, MERGE_BATCH)) > 0) {
+		if (merge.render != NULL)
+			render_add(merge.render, batch, n);
+		else
+			for (i = 0; i < n; i++)
+				prrev(batch[i], NULL);
+		merge_release(&merge);
+	}
+	if (merge.render != NULL) {
+		render_finish(merge.render);
+		merge.render = NULL;
+		merge_release(&merge);
+	}
+	if (stream != NULL)
+		revstream_free(stream);
+	if (fstats != NULL) {
+		prtotals(files, nfiles);
+		free(fstats);
+	}
 
-	rcsp = malloc((size_t) nfiles * sizeof(*rcsp));
+	/* Those left after --limit */
+	for (i = 0; i < merge.nheap; i++)
+		if (merge.heap[i]->rcsp != NULL)
+			rcsfile_free(merge.heap[i]->rcsp);
 	for (i = 0; i < nfiles; i++) {
-		struct revnode **rpp;
+		free(files[i].list);
+		free(files[i].path);
+		free(files[i].branch);
+		numfree(&files[i].key.date);
+	}
+	free(files);
+	free(merge.heap);
+	free(merge.closing);
+	for (i = 0; i < merge.ntop; i++) {
+		numfree(&merge.top[i]->date);
+		free(merge.top[i]);
+	}
+	free(merge.top);
+	numfree(&filter.since);
+	numfree(&filter.until);
+	out_flush();
+	if (textcache_budget() != 0)
+		textcache_report();
+
+	return 0;
+}
+
+/*
+ * Rank the files by path, as revsort() wants.  A file given twice shares
+ * its rank.
+ */
+static void
+merge_rank(struct mfile *files, int nfiles) {
+	struct mfile **byname;
+	int i;
+
+	byname = malloc((size_t)nfiles * sizeof(*byname));
+	for (i = 0; i < nfiles; i++)
+		byname[i] = &files[i];
+	qsort(byname, (size_t)nfiles, sizeof(*byname), mfilebypath);
+	for (i = 0; i < nfiles; i++)
+		byname[i]->rank = (i > 0 && mfilebypath(&byname[i],
+		    &byname[i - 1]) == 0) ? byname[i - 1]->rank : i;
+	free(byname);
+}
+
+static int
+mfilebypath(const void *v1, const void *v2) {
+	const struct mfile *m1 = *(struct mfile *const *)v1;
+	const struct mfile *m2 = *(struct mfile *const *)v2;
+
+	return strcmp(m1->path, m2->path);
+}
+
+/*
+ * Take mfp, just opened with its list of revisions, into the merge.
+ */
+static void
+merge_add(struct merge *mp, struct mfile *mfp) {
+	struct rcsfile *rcsp = mfp->rcsp;
+
+	mp->nopen++;
+	mfp->last = -1;
+	rcsp->rank = mfp->rank;
+	if (mp->ngroups > 1)
+		rcsp->cache = textcache_get(mfp->rank % mp->ngroups);
+	for (mfp->nrevs = 0; mfp->list[mfp->nrevs] != NULL; mfp->nrevs++)
+		;
+	revsort(mfp->list, mfp->nrevs);
+	if (mfp->nrevs != 0 && mp->limit != 0 && !merge_top(mp, mfp)) {
+		mfp->opened = 0;
+		mfp->nrevs = 0;
+	}
+	if (mfp->nrevs == 0) {
+		mp->nopen--;
+		mfp->closing = 1;
+		mp->closing[mp->nclosing++] = mfp;
+		mfp->listed = 1;
+		return;
+	}
+
+	mfp->next = 0;
+	revkey_set(&mfp->key, mfp->list[0], mfp);
+	mp->heap[mp->nheap] = mfp;
+	heap_up(mp, mp->nheap++);
+	if (mp->nopen > MERGE_MAXOPEN)
+		merge_evict(mp, NULL);
+}
+
+/*
+ * Put up to max of the next revisions in out, and return how many.
+ */
+static int
+merge_next(struct merge *mp, struct revnode **out, int max) {
+	struct mfile *mfp;
+	int n = 0;
+
+	while (n < max && mp->nheap > 0 &&
+	    (mp->limit == 0 || mp->taken < mp->limit)) {
+		mfp = mp->heap[0];
+		if (mfp->rcsp == NULL)
+			merge_reopen(mp, mfp);
+		else if (mfp->closing) {
+			mfp->closing = 0;
+			if (++mp->nopen > MERGE_MAXOPEN)
+				merge_evict(mp, mfp);
+		}
 
-		if ((rcsp[i] = rcsfile_smartopen(filelist[i], &branch)) == NULL)
+		out[n++] = mfp->list[mfp->next++];
+		mfp->last = mp->taken++;
+		if (mfp->next < mfp->nrevs) {
+			revkey_set(&mfp->key, mfp->list[mfp->next], mfp);
+			heap_down(mp, 0);
 			continue;
-		if (mflag)
-			rcsfile_setflags(rcsp[i], RCSFILE_LOWMEM);
+		}
 
-		if ((rltmp = revlist(rcsp[i], branch)) == NULL) {
-			warnx("%s: %s: no such branch\n", filelist[i],
-			    argv[2]);
+		mp->heap[0] = mp->heap[--mp->nheap];
+		heap_down(mp, 0);
+		mp->nopen--;
+		mfp->closing = 1;
+		if (!mfp->listed) {
+			mp->closing[mp->nclosing++] = mfp;
+			mfp->listed = 1;
+		}
+	}
+	return n;
+}
+
+/*
+ * Close the files marked for it, once what was taken from them has been
+ * shown, and keep the rest marked.  While the render threads run, what
+ * has been shown is what they have written out, and a file is freed
+ * holding the lock of its group, since its text cache is shared.
+ */
+static void
+merge_release(struct merge *mp) {
+	struct mfile *mfp;
+	pthread_mutex_t *lock;
+	int i, n = 0, shown;
+
+	shown = (mp->render != NULL) ? mp->render->emitted : mp->taken;
+	for (i = 0; i < mp->nclosing; i++) {
+		mfp = mp->closing[i];
+		if (mfp->closing && mfp->last >= shown) {
+			mp->closing[n++] = mfp;
 			continue;
 		}
+		mfp->listed = 0;
+		if (!mfp->closing)
+			continue;
+		mfp->closing = 0;
+		lock = (mp->render != NULL) ?
+		    &mp->render->group[mfp->rank % mp->render->ngroups] : NULL;
+		if (lock != NULL)
+			pthread_mutex_lock(lock);
+		rcsfile_free(mfp->rcsp);
+		if (lock != NULL)
+			pthread_mutex_unlock(lock);
+		mfp->rcsp = NULL;
+		free(mfp->list);
+		mfp->list = NULL;
+	}
+	mp->nclosing = n;
+}
+
+/*
+ * Open mfp again, to carry on from where it was closed.  Its messages
+ * were shown the first time, so they are only shown now if it can't be
+ * read as it was.
+ */
+static void
+merge_reopen(struct merge *mp, struct mfile *mfp) {
+	struct ingest job;
+	int n;
 
-		for (rpp = rltmp; *rpp != NULL; rpp++) {
-			if (rnum == rlist_len) {
-				rlist_len += rlist_len + 1;
-				rlist = realloc(rlist, (size_t) rlist_len *
-				    sizeof(*rlist));
+	if (mp->nopen >= MERGE_MAXOPEN)
+		merge_evict(mp, mfp);
+
+	bzero(&job, sizeof(job));
+	job.path = mfp->path;
+	job.branch = mfp->branch;
+	job.flags = mp->flags;
+	job.filter = mp->filter;
+	rcsdiag_init(&job.diag);
+	ingest_one(&job);
+
+	n = 0;
+	if (job.rlist != NULL)
+		while (job.rlist[n] != NULL)
+			n++;
+	if (job.rcsp == NULL || n != mfp->nrevs) {
+		rcsdiag_replay(&job.diag);
+		errx(1, "%s: changed while being read", mfp->path);
+	}
+	rcsdiag_free(&job.diag);
+
+	mfp->rcsp = job.rcsp;
+	mfp->rcsp->diag = NULL;
+	mfp->rcsp->rank = mfp->rank;
+	if (mp->ngroups > 1)
+		mfp->rcsp->cache = textcache_get(mfp->rank % mp->ngroups);
+	mfp->list = job.rlist;
+	revsort(mfp->list, n);
+	mp->nopen++;
+}
+
+/*
+ * Close, after this batch, the open file other than except whose next
+ * revision is the last to be needed.
+ */
+static void
+merge_evict(struct merge *mp, struct mfile *except) {
+	struct mfile *mfp, *victim = NULL;
+	int i;
+
+	for (i = 0; i < mp->nheap; i++) {
+		mfp = mp->heap[i];
+		if (mfp == except || mfp->rcsp == NULL || mfp->closing)
+			continue;
+		if (victim == NULL || revkey_cmp(&mfp->key, &victim->key) > 0)
+			victim = mfp;
+	}
+	if (victim == NULL)
+		return;
+
+	mp->nopen--;
+	victim->closing = 1;
+	if (!victim->listed) {
+		mp->closing[mp->nclosing++] = victim;
+		victim->listed = 1;
+	}
+}
+
+/*
+ * Add the keys of mfp's revisions to the newest seen, for as long as
+ * they are among them.  Return 0 if none of them is.
+ */
+static int
+merge_top(struct merge *mp, struct mfile *mfp) {
+	struct revkey *kp;
+	int i, j, child;
+
+	for (i = 0; i < mfp->nrevs; i++) {
+		if (mp->ntop < mp->limit) {
+			if (mp->ntop == mp->top_len) {
+				mp->top_len += mp->top_len + 16;
+				if (mp->top_len > mp->limit)
+					mp->top_len = mp->limit;
+				mp->top = realloc(mp->top, (size_t)mp->top_len *
+				    sizeof(*mp->top));
 			}
-			rlist[rnum++] = *rpp;
+			kp = calloc(1, sizeof(*kp));
+			revkey_set(kp, mfp->list[i], mfp);
+			for (j = mp->ntop++; j > 0 && revkey_cmp(mp->top[(j -
+			    1) / 2], kp) < 0; j = (j - 1) / 2)
+				mp->top[j] = mp->top[(j - 1) / 2];
+			mp->top[j] = kp;
+			continue;
+		}
+
+		revkey_set(&mfp->key, mfp->list[i], mfp);
+		if (revkey_cmp(&mfp->key, mp->top[0]) >= 0)
+			break;
+		kp = mp->top[0];
+		revkey_set(kp, mfp->list[i], mfp);
+		for (j = 0; (child = 2 * j + 1) < mp->ntop; j = child) {
+			if (child + 1 < mp->ntop && revkey_cmp(mp->top[child +
+			    1], mp->top[child]) > 0)
+				child++;
+			if (revkey_cmp(kp, mp->top[child]) >= 0)
+				break;
+			mp->top[j] = mp->top[child];
 		}
-		free(rltmp);
+		mp->top[j] = kp;
 	}
+	return i > 0;
+}
 
-	qsort(rlist, (size_t) rnum, sizeof(*rlist), revbydate);
-	for (i = 0; i < rnum; i++)
-		prrev(rlist[i]);
-	free(rlist);
+/*
+ * The order of revisions over all the files: that of revbydate(), and
+ * then that of the files, so revisions with the same date and name are
+ * shown as they would be by one stable sort of them all.
+ */
+static int
+revkey_cmp(const struct revkey *k1, const struct revkey *k2) {
+	int ret;
 
-	for (i = 0; i < nfiles; i++)
-		if (rcsp[i] != NULL)
-			rcsfile_free(rcsp[i]);
+	if (k1->sortkey != 0 && k2->sortkey != 0) {
+		if (k1->sortkey != k2->sortkey)
+			return (k1->sortkey < k2->sortkey) ? -1 : 1;
+	} else {
+		if ((ret = -numcmp(&k1->date, &k2->date)) != 0)
+			return ret;
+		if ((ret = strcmp(k1->path, k2->path)) != 0)
+			return (ret < 0) ? -1 : 1;
+	}
+	return (k1->index < k2->index) ? -1 : (k1->index > k2->index);
+}
 
-	return 0;
+static void
+revkey_set(struct revkey *kp, struct revnode *revp, struct mfile *mfp) {
+	const struct rcsnum *date = &revp->info->date;
+
+	kp->sortkey = revp->sortkey;
+	/* Dates are nearly always of six components, so keep the room */
+	if (kp->date.len != date->len) {
+		numfree(&kp->date);
+		numalloc(&kp->date, date->len, NULL);
+	}
+	if (date->len > 0)
+		bcopy(date->num, kp->date.num, (size_t)RCSNUM_BYTES(date));
+	kp->path = mfp->path;
+	kp->index = mfp->index;
+}
+
+static void
+heap_up(struct merge *mp, int i) {
+	struct mfile *mfp = mp->heap[i];
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (revkey_cmp(&mp->heap[parent]->key, &mfp->key) <= 0)
+			break;
+		mp->heap[i] = mp->heap[parent];
+		i = parent;
+	}
+	mp->heap[i] = mfp;
+}
+
+static void
+heap_down(struct merge *mp, int i) {
+	struct mfile *mfp;
+	int child;
+
+	if (mp->nheap == 0)
+		return;
+	mfp = mp->heap[i];
+	while ((child = 2 * i + 1) < mp->nheap) {
+		if (child + 1 < mp->nheap &&
+		    revkey_cmp(&mp->heap[child + 1]->key,
+		    &mp->heap[child]->key) < 0)
+			child++;
+		if (revkey_cmp(&mfp->key, &mp->heap[child]->key) <= 0)
+			break;
+		mp->heap[i] = mp->heap[child];
+		i = child;
+	}
+	mp->heap[i] = mfp;
+}
+
+/*
+ * Start nthreads threads showing the revisions given to render_add(),
+ * of files in ngroups groups.  The text cache of a file must be that of
+ * its group, textcache_get() of its rank modulo ngroups.
+ */
+static struct renderpool *
+render_start(int nthreads, int ngroups) {
+	struct renderpool *pool;
+	int i, error;
+
+	pool = calloc(1, sizeof(*pool));
+	for (i = 0; i < RENDER_WINDOW; i++)
+		pool->out[i] = outbuf_create();
+	pool->nthreads = nthreads;
+	pool->ngroups = ngroups;
+	pool->group = malloc((size_t)ngroups * sizeof(*pool->group));
+	for (i = 0; i < ngroups; i++)
+		pthread_mutex_init(&pool->group[i], NULL);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->added, NULL);
+	pthread_cond_init(&pool->filled, NULL);
+
+	pool->threads = malloc((size_t)nthreads * sizeof(*pool->threads));
+	for (i = 0; i < nthreads; i++)
+		if ((error = pthread_create(&pool->threads[i], NULL,
+		    render_worker, pool)) != 0)
+			errx(1, "pthread_create: %s", strerror(error));
+
+	return pool;
+}
+
+/*
+ * Show the n revisions in list after those given before, writing out
+ * what has been shown whenever the ring is full.
+ */
+static void
+render_add(struct renderpool *pool, struct revnode **list, int n) {
+	int i, room;
+
+	while (n > 0) {
+		room = RENDER_WINDOW - (pool->nrevs - pool->emitted);
+		if (room == 0) {
+			render_emit(pool);
+			continue;
+		}
+		if (room > n)
+			room = n;
+
+		pthread_mutex_lock(&pool->lock);
+		for (i = 0; i < room; i++)
+			pool->rev[(pool->nrevs + i) % RENDER_WINDOW] = list[i];
+		pool->nrevs += room;
+		pthread_cond_broadcast(&pool->added);
+		pthread_mutex_unlock(&pool->lock);
+		list += room;
+		n -= room;
+	}
+}
+
+/*
+ * Wait for the oldest revision not yet written out, and write out it and
+ * those after it which are done, in one go, without the lock; the slots
+ * are not reused until emitted has passed them.  Only the main thread
+ * moves nrevs and emitted.
+ */
+static void
+render_emit(struct renderpool *pool) {
+	struct outbuf *ready[RENDER_WINDOW];
+	int i, k;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->done[pool->emitted % RENDER_WINDOW])
+		pthread_cond_wait(&pool->filled, &pool->lock);
+	for (k = 0; pool->emitted + k < pool->nrevs; k++) {
+		i = (pool->emitted + k) % RENDER_WINDOW;
+		if (!pool->done[i])
+			break;
+		ready[k] = pool->out[i];
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	out_emit(ready, k);
+
+	pthread_mutex_lock(&pool->lock);
+	for (i = 0; i < k; i++)
+		pool->done[(pool->emitted + i) % RENDER_WINDOW] = 0;
+	pool->emitted += k;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Write out all that is left, and stop the threads.
+ */
+static void
+render_finish(struct renderpool *pool) {
+	int i;
+
+	while (pool->emitted < pool->nrevs)
+		render_emit(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->closed = 1;
+	pthread_cond_broadcast(&pool->added);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+	free(pool->threads);
+	for (i = 0; i < pool->ngroups; i++)
+		pthread_mutex_destroy(&pool->group[i]);
+	free(pool->group);
+	for (i = 0; i < RENDER_WINDOW; i++)
+		outbuf_free(pool->out[i]);
+	pthread_cond_destroy(&pool->added);
+	pthread_cond_destroy(&pool->filled);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+static void *
+render_worker(void *arg) {
+	struct renderpool *pool = arg;
+	struct revnode *revp;
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (pool->next == pool->nrevs && !pool->closed)
+			pthread_cond_wait(&pool->added, &pool->lock);
+		if (pool->next == pool->nrevs)
+			break;
+		i = pool->next++ % RENDER_WINDOW;
+		revp = pool->rev[i];
+		pthread_mutex_unlock(&pool->lock);
+
+		out_select(pool->out[i]);
+		prrev(revp, &pool->group[revp->rcsp->rank % pool->ngroups]);
+
+		pthread_mutex_lock(&pool->lock);
+		pool->done[i] = 1;
+		pthread_cond_signal(&pool->filled);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	out_select(NULL);
+	return NULL;
+}
+
+/*
+ * A date, in UTC, as yyyy-mm-dd with perhaps hh:mm or hh:mm:ss after a
+ * space or a T, or as an RCS date.  What is left out is the start of the
+ * day or minute given, or its end if end is set.  A year below 100 is in
+ * the 1900s, as in the dates of RCS files.
+ */
+static void
+parse_date(const char *s, struct rcsnum *np, int end) {
+	static const char *const seps[] = {"-.", "-.", " T.", ":.", ":."};
+	static const int maxval[] = {9999, 12, 31, 23, 59, 60};
+	static const int endval[] = {9999, 12, 31, 23, 59, 59};
+	const char *p = s;
+	char *ep;
+	long n;
+	int i;
+
+	numalloc(np, 6, NULL);
+	for (i = 0; i < 6; i++) {
+		if (*p == '\0' && (i == 3 || i == 5)) {
+			for (; i < 6; i++)
+				np->num[i] = end ? endval[i] : 0;
+			break;
+		}
+		n = strtol(p, &ep, 10);
+		if (i == 0 && n >= 0 && n < 100)
+			n += 1900;
+		if (ep == p || !isdigit((unsigned char)*p) || n < (i < 3) ||
+		    n > maxval[i])
+			usage();
+		np->num[i] = (int)n;
+		p = ep;
+		if (i < 5 && *p != '\0') {
+			if (strchr(seps[i], *p) == NULL)
+				usage();
+			p++;
+		}
+	}
+	if (*p != '\0')
+		usage();
+}
+
+/*
+ * A number of bytes, perhaps followed by K, M or G.
+ */
+static size_t
+parse_size(const char *s) {
+	unsigned long long n;
+	char *ep;
+
+	n = strtoull(s, &ep, 10);
+	switch (*ep) {
+	case 'G':
+	case 'g':
+		n *= 1024;
+		/* FALLTHROUGH */
+	case 'M':
+	case 'm':
+		n *= 1024;
+		/* FALLTHROUGH */
+	case 'K':
+	case 'k':
+		n *= 1024;
+		ep++;
+		break;
+	}
+	if (ep == s || *ep != '\0' || n == 0 || n > (size_t)-1)
+		usage();
+	return (size_t)n;
+}
+
+/*
+ * Start nthreads threads opening the files given to ingest_add().
+ */
+static struct ingestpool *
+ingest_start(int flags, const struct rcsfilter *filter, int nthreads) {
+	struct ingestpool *pool;
+	int i, error;
+
+	pool = calloc(1, sizeof(*pool));
+	pool->flags = flags;
+	pool->filter = filter;
+	pool->nthreads = nthreads;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->added, NULL);
+
+	pool->threads = malloc((size_t)nthreads * sizeof(*pool->threads));
+	for (i = 0; i < nthreads; i++)
+		if ((error = pthread_create(&pool->threads[i], NULL,
+		    ingest_worker, pool)) != 0)
+			errx(1, "pthread_create: %s", strerror(error));
+
+	return pool;
+}
+
+static void
+ingest_add(struct ingestpool *pool, const char *path, char *branch) {
+	struct ingest *job;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->njobs == pool->nblk * INGEST_BLK) {
+		pool->blk = realloc(pool->blk, (size_t)(pool->nblk + 1) *
+		    sizeof(*pool->blk));
+		pool->blk[pool->nblk++] = calloc(INGEST_BLK,
+		    sizeof(**pool->blk));
+	}
+	job = INGEST_JOB(pool, pool->njobs);
+	job->path = path;
+	job->branch = branch;
+	job->flags = pool->flags;
+	job->filter = pool->filter;
+	rcsdiag_init(&job->diag);
+	pool->njobs++;
+	pthread_cond_signal(&pool->added);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Wait for the files added to have been opened.
+ */
+static void
+ingest_finish(struct ingestpool *pool) {
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->closed = 1;
+	pthread_cond_broadcast(&pool->added);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+}
+
+/*
+ * Jobs are taken by pointer, with the lock held, since the table of
+ * blocks may be moved as more are added.
+ */
+static void *
+ingest_worker(void *arg) {
+	struct ingestpool *pool = arg;
+	struct ingest *job;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (pool->next == pool->njobs && !pool->closed)
+			pthread_cond_wait(&pool->added, &pool->lock);
+		if (pool->next == pool->njobs)
+			break;
+		job = INGEST_JOB(pool, pool->next);
+		pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		ingest_one(job);
+
+		pthread_mutex_lock(&pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+static void
+ingest_one(struct ingest *job) {
+	if (setjmp(job->diag.env) != 0)
+		return;
+
+	if ((job->rcsp = rcsfile_opendiag(job->path, job->flags, job->filter,
+	    &job->diag)) == NULL)
+		return;
+	job->rlist = revlist(job->rcsp, job->branch);
+}
+
+/*
+ * Print the messages from opening file i, and return what the serial loop
+ * would have got from rcsfile_smartopen() and revlist().
+ */
+static struct rcsfile *
+ingest_result(struct ingestpool *pool, int i, struct revnode ***rlistp) {
+	struct ingest *job = INGEST_JOB(pool, i);
+
+	rcsdiag_replay(&job->diag);
+	if (job->rcsp != NULL)
+		job->rcsp->diag = NULL;
+	*rlistp = job->rlist;
+	return job->rcsp;
+}
+
+static void
+ingest_free(struct ingestpool *pool) {
+	int i;
+
+	for (i = 0; i < pool->njobs; i++)
+		rcsdiag_free(&INGEST_JOB(pool, i)->diag);
+	for (i = 0; i < pool->nblk; i++)
+		free(pool->blk[i]);
+	free(pool->blk);
+	free(pool->threads);
+	pthread_cond_destroy(&pool->added);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
 }
 
 void
-prrev(struct revnode *revp) {
+prrev(struct revnode *revp, pthread_mutex_t *lock) {
+	struct revinfo *rip = revp->info;
+	struct rcsfile *rcsp = revp->rcsp;
+	struct rcsdiff diff;
+	long add = 0, del = 0;
+	int text;
 
-	printf("REV:%-20.*s%-20.*s %d/%02d/%02d %02d:%02d:%02d       %.*s\n",
-	    revp->revtext.len, revp->revtext.start,
-	    revp->rcsp->shortfname.len, revp->rcsp->shortfname.start,
-	    revp->date.num[0], revp->date.num[1], revp->date.num[2],
-	    revp->date.num[3], revp->date.num[4], revp->date.num[5],
-	    revp->author.len, revp->author.start);
+	/* What is built for the file is built holding its lock, if shared */
+	text = !(rcsp->flags & RCSFILE_NOTEXT) && fstats == NULL &&
+	    stream == NULL;
+	if (lock != NULL)
+		pthread_mutex_lock(lock);
+	rev_loadtext(revp);
+	if (!(rcsp->flags & RCSFILE_NOTEXT) && fstats != NULL) {
+		rev_diffstat(revp, &add, &del);
+		fstats[rcsp->rank].add += add;
+		fstats[rcsp->rank].del += del;
+	}
+	if (text) {
+		rev_calc(revp);
+		rev_diffstart(revp, 0, &diff);
+	}
+	if (lock != NULL)
+		pthread_mutex_unlock(lock);
 
-	prlist("branchpoints:", revp->branchpoints);
-	prlist("branches:    ", revp->branches);
-	prlist("tags:        ", revp->tags);
+	out_str("REV:");
+	out_text(rip->revtext.start, rip->revtext.len, 20);
+	out_text(rcsp->shortfname.start, rcsp->shortfname.len, 20);
+	out_char(' ');
+	out_date(&rip->date);
+	out_str("       ");
+	out_text(rip->author.start, rip->author.len, 0);
+	out_char('\n');
 
-	printf("\n");
+	prlist("branchpoints:", rip->branchpoints);
+	prlist("branches:    ", rev_branches(revp));
+	prlist("tags:        ", rip->tags);
+
+	out_char('\n');
 	prlog(revp);
-	printf("\n");
-	rev_calc(revp);
+	out_char('\n');
+	if (rcsp->flags & RCSFILE_NOTEXT)
+		return;
+	if (fstats != NULL) {
+		prstat(&rcsp->shortfname, add, del);
+		return;
+	}
+	if (stream != NULL) {
+		revstream_diff(stream, revp, 3);
+		return;
+	}
 
 #if 0
-	TEXTLIST_FOREACH(revp->outputlines, textp)
-		printf("%.*s", textp->len, textp->start);
+	TEXTLIST_FOREACH(rip->outputlines, textp)
+		printf("%.*s", (int)textp->len, textp->start);
 #endif
-	rev_diff(revp, 3, 0);
+	rev_diffprint(&diff, 3);
+
+	if (lock != NULL)
+		pthread_mutex_lock(lock);
+	rev_diffend(&diff);
+	if (lock != NULL)
+		pthread_mutex_unlock(lock);
+}
+
+#define STAT_WIDTH	50		/* most +'s and -'s for --stat */
+
+/*
+ * Show the lines added to and deleted from a file, as a count for
+ * --numstat, or with a bar of +'s and -'s for --stat.
+ */
+static void
+prstat(struct rcstext *name, long add, long del) {
+	long nadd, ndel;
+
+	if (statmode == STAT_NUM) {
+		out_long(add, 0);
+		out_char('\t');
+		out_long(del, 0);
+		out_char('\t');
+		out_text(name->start, name->len, 0);
+		out_char('\n');
+		return;
+	}
+
+	nadd = add;
+	ndel = del;
+	if (add + del > STAT_WIDTH) {
+		nadd = (add * STAT_WIDTH + (add + del) / 2) / (add + del);
+		if (nadd == 0 && add != 0)
+			nadd = 1;
+		if (nadd == STAT_WIDTH && del != 0)
+			nadd--;
+		ndel = STAT_WIDTH - nadd;
+	}
+	out_printf(" %-20.*s | %6ld ", (int)name->len, name->start,
+	    add + del);
+	while (nadd-- > 0)
+		out_char('+');
+	while (ndel-- > 0)
+		out_char('-');
+	out_char('\n');
+}
+
+/*
+ * After the revisions, the totals for each file, in the order given and
+ * by its full name.  A file given twice has one rank, and is shown once.
+ */
+static void
+prtotals(struct mfile *files, int nfiles) {
+	struct filestat *fsp;
+	struct rcstext name;
+	long add, del;
+	int i, n;
+
+	out_str("\nTOTAL:\n");
+	add = del = 0;
+	n = 0;
+	for (i = 0; i < nfiles; i++) {
+		if (!files[i].opened)
+			continue;
+		fsp = &fstats[files[i].rank];
+		if (fsp->shown)
+			continue;
+		fsp->shown = 1;
+		name.start = files[i].path;
+		name.len = (long)strlen(name.start);
+		prstat(&name, fsp->add, fsp->del);
+		add += fsp->add;
+		del += fsp->del;
+		n++;
+	}
+	if (statmode == STAT_STAT)
+		out_printf(" %d file%s changed, %ld insertion%s(+), "
+		    "%ld deletion%s(-)\n", n, n == 1 ? "" : "s",
+		    add, add == 1 ? "" : "s", del, del == 1 ? "" : "s");
 }
 
 void
@@ -183,112 +1337,66 @@ onerev(char *filename, char *revname) {
 	struct rcsfile *rcsp;
 	struct revnode *revp;
 
-	if ((rcsp = rcsfile_open(filename)) == NULL)
+	if ((rcsp = rcsfile_openflags(filename,
+	    lflag ? RCSFILE_NOTEXT : 0)) == NULL)
 		err(1, "%s: rcsfile_open", filename);
 
 	revp = namedobjlist_lookup(rcsp->revs, revname, (int) strlen(revname));
 	if (revp == NULL)
 		errx(1, "%s: %s: revision not found", filename, revname);
 
-	prlist("branchpoints:", revp->branchpoints);
-	prlist("branches:    ", revp->branches);
-	prlist("tags:        ", revp->tags);
-	rev_diff(revp, 3, 0);
+	prlist("branchpoints:", revp->info->branchpoints);
+	prlist("branches:    ", rev_branches(revp));
+	prlist("tags:        ", revp->info->tags);
+	if (lflag)
+		prlog(revp);
+	else
+		rev_diff(revp, 3, 0);
 }
 
 void
 prlist(const char *prefix, struct textlist *tlp) {
 	struct rcstext *textp;
-	int len = 0;
+	long len = 0;
 	int prefixlen = (int) strlen(prefix) + 4;
 
-	if (tlp->len == 0)
+	if (tlp == NULL || tlp->len == 0)
 		return;
 
 	TEXTLIST_FOREACH(tlp, textp) {
 		if (len == 0 || len + textp->len > 75) {
 			if (len == 0)
-				printf("%-*s", prefixlen, prefix);
-			else
-				printf(",\n%-*s", prefixlen, "");
+				out_text(prefix, (long)strlen(prefix),
+				    prefixlen);
+			else {
+				out_str(",\n");
+				out_text("", 0, prefixlen);
+			}
 			len = prefixlen;
 		}
 		if (len > prefixlen) {
-			printf(", ");
+			out_str(", ");
 			len += 2;
 		}
-		printf("%.*s", textp->len, textp->start);
+		out_text(textp->start, textp->len, 0);
 		len += textp->len;
 	}
-	printf("\n");
+	out_char('\n');
 }
 
 void
 prlog(struct revnode *revp) {
 	struct rcstext *textp;
-	struct textlist *tlp = textsplit(&revp->log);
+	struct textlist *tlp;
+
+	rev_loadtext(revp);
+	tlp = textsplit(&revp->info->log, NULL);
 
 	TEXTLIST_FOREACH(tlp, textp) {
 		if (textp->len != 1 || textp->start[0] != '\n')
-			printf("   ");
+			out_str("   ");
 		textprint(textp);
 	}
 
 	textlist_destroy(tlp);
 }
-
-void
-filelist_expand(char ***filelistp, int *nfilesp)
-{
-	FTS *fts;
-	FTSENT *fe;
-	char **newlist;
-	int newlist_arraysize, nfiles;
-
-	fts = fts_open(*filelistp, FTS_PHYSICAL, filelist_ftscmp);
-	if (fts == NULL)
-		err(1, "ftsopen");
-
-	newlist = malloc(sizeof(*newlist));
-	if (newlist == NULL)
-		err(1, "realloc");
-	newlist_arraysize = 1;
-	nfiles = 0;
-	while ((fe = fts_read(fts)) != NULL) {
-		switch (fe->fts_info) {
-		case FTS_DNR:
-		case FTS_ERR:
-		case FTS_NS:
-			warnx("%s: %s", fe->fts_path, strerror(fe->fts_errno));
-			continue;
-		case FTS_F:
-			break;
-		default:
-			continue;
-		}
-
-		if (nfiles + 1 == newlist_arraysize) {
-			newlist_arraysize += newlist_arraysize + 1;
-			newlist = realloc(newlist, (size_t) newlist_arraysize *
-			    sizeof(*newlist));
-			if (newlist == NULL)
-				err(1, "realloc");
-		}
-		newlist[nfiles] = strdup(fe->fts_path);
-		if (newlist[nfiles] == NULL)
-			err(1, "strdup");
-		nfiles++;
-	}
-	if (fts_close(fts) != 0)
-		err(1, "fts_close");
-
-	newlist[nfiles] = NULL;
-	*filelistp = newlist;
-	*nfilesp = nfiles;
-}
-
-int
-filelist_ftscmp(const FTSENT * *fe1, const FTSENT * *fe2)
-{
-	return (strcoll((*fe1)->fts_name, (*fe2)->fts_name));
-}
@@ -27,6 +27,28 @@
 #ifndef RCSHIST_H
 #define RCSHIST_H
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+/*
+ * config.h defines these only when configured --with-warnings.
+ */
+#ifndef GCC_UNUSED
+#ifdef __GNUC__
+#define GCC_UNUSED	__attribute__((unused))
+#else
+#define GCC_UNUSED		/* nothing */
+#endif
+#endif
+#ifndef GCC_NORETURN
+#ifdef __GNUC__
+#define GCC_NORETURN	__attribute__((noreturn))
+#else
+#define GCC_NORETURN		/* nothing */
+#endif
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
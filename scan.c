@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2026 Thomas E. Dickey <dickey@invisible-island.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id: scan.c,v 1.1 2026/10/17 12:00:00 tom Exp $
+ */
+#include "rcshist.h"
+#include "scan.h"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define USE_SSE2 1
+#include <emmintrin.h>
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || \
+    (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define USE_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+/*
+ * Character classes, following rcsfile(5): whitespace separates tokens,
+ * ':' and ';' are tokens by themselves, and a word made only of digits
+ * and '.' is a revision number.
+ */
+#define CL_SPACE	0x01
+#define CL_DELIM	0x02
+#define CL_NUM		0x04
+
+static const unsigned char classes[256] = {
+	[' '] = CL_SPACE | CL_DELIM,
+	['\b'] = CL_SPACE | CL_DELIM,
+	['\t'] = CL_SPACE | CL_DELIM,
+	['\n'] = CL_SPACE | CL_DELIM,
+	['\002'] = CL_SPACE | CL_DELIM,
+	['\f'] = CL_SPACE | CL_DELIM,
+	['\r'] = CL_SPACE | CL_DELIM,
+	[':'] = CL_DELIM,
+	[';'] = CL_DELIM,
+	['0'] = CL_NUM, ['1'] = CL_NUM, ['2'] = CL_NUM, ['3'] = CL_NUM,
+	['4'] = CL_NUM, ['5'] = CL_NUM, ['6'] = CL_NUM, ['7'] = CL_NUM,
+	['8'] = CL_NUM, ['9'] = CL_NUM, ['.'] = CL_NUM,
+};
+
+#define IS_SPACE(c)	(classes[(unsigned char)(c)] & CL_SPACE)
+#define IS_DELIM(c)	(classes[(unsigned char)(c)] & CL_DELIM)
+#define IS_NUM(c)	(classes[(unsigned char)(c)] & CL_NUM)
+
+/*
+ * Portable versions, also used for the tail of the buffer which is too
+ * short for a vector load.
+ */
+static const char *
+space_scalar(const char *p, const char *end) {
+	while (p < end && IS_SPACE(*p))
+		p++;
+	return p;
+}
+
+/*
+ * *isnump is only ever cleared, so that a vector loop can hand the tail
+ * of a word to this.
+ */
+static const char *
+word_scalar(const char *p, const char *end, int *isnump) {
+	while (p < end && !IS_DELIM(*p)) {
+		if (!IS_NUM(*p))
+			*isnump = 0;
+		p++;
+	}
+	return p;
+}
+
+static const char *
+string_scalar(const char *p, const char *end) {
+	while (p < end && (p = memchr(p, '@', (size_t)(end - p))) != NULL) {
+		if (p + 1 < end && p[1] == '@') {
+			p += 2;
+			continue;
+		}
+		return p;
+	}
+	return NULL;
+}
+
+static const struct scanner scan_portable = {
+	space_scalar, word_scalar, string_scalar
+};
+
+#ifdef USE_SSE2
+static __m128i
+space_sse2(__m128i v) {
+	__m128i m;
+
+	m = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\002')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\b')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\f')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+	return m;
+}
+
+static const char *
+scan_space_sse2(const char *p, const char *end) {
+	unsigned m;
+
+	/* Most runs of whitespace are a single byte */
+	if (p < end && !IS_SPACE(*p))
+		return p;
+
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(const void *)p);
+
+		m = (unsigned)_mm_movemask_epi8(space_sse2(v));
+		if (m != 0xffff)
+			return p + __builtin_ctz(~m);
+		p += 16;
+	}
+	return space_scalar(p, end);
+}
+
+static const char *
+scan_word_sse2(const char *p, const char *end, int *isnump) {
+	const __m128i zero = _mm_set1_epi8('0');
+	const __m128i nine = _mm_set1_epi8(9);
+	unsigned d, n, want;
+
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(const void *)p);
+		__m128i x = _mm_sub_epi8(v, zero);
+		__m128i m = space_sse2(v);
+
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(':')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+		d = (unsigned)_mm_movemask_epi8(m);
+
+		m = _mm_cmpeq_epi8(_mm_min_epu8(x, nine), x);
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+		n = (unsigned)_mm_movemask_epi8(m);
+
+		if (d != 0) {
+			want = (1u << __builtin_ctz(d)) - 1;
+			if ((n & want) != want)
+				*isnump = 0;
+			return p + __builtin_ctz(d);
+		}
+		if (n != 0xffff)
+			*isnump = 0;
+		p += 16;
+	}
+	return word_scalar(p, end, isnump);
+}
+
+/*
+ * Each '@' in a block is either half of an '@@' pair or the end of the
+ * string.  An '@' in the last byte of a block is paired (or not) with
+ * the first byte of the next block.
+ */
+static const char *
+scan_string_sse2(const char *p, const char *end) {
+	const __m128i at = _mm_set1_epi8('@');
+	int pending = 0;
+	unsigned m;
+	int i;
+
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(const void *)p);
+
+		m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, at));
+		if (pending) {
+			if (!(m & 1))
+				return p - 1;
+			m &= ~1u;
+			pending = 0;
+		}
+		while (m != 0) {
+			i = __builtin_ctz(m);
+			if (i == 15) {
+				pending = 1;
+				break;
+			}
+			if (!(m & (2u << i)))
+				return p + i;
+			m &= ~(3u << i);
+		}
+		p += 16;
+	}
+	if (pending) {
+		if (p == end || *p != '@')
+			return p - 1;
+		p++;
+	}
+	return string_scalar(p, end);
+}
+
+static const struct scanner scan_sse2 = {
+	scan_space_sse2, scan_word_sse2, scan_string_sse2
+};
+#endif /* USE_SSE2 */
+
+#ifdef USE_AVX2
+#define AVX2 __attribute__((target("avx2")))
+
+static AVX2 __m256i
+space_avx2(__m256i v) {
+	__m256i m;
+
+	m = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\002')));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\b')));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\f')));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+	return m;
+}
+
+static AVX2 const char *
+scan_space_avx2(const char *p, const char *end) {
+	unsigned m;
+
+	if (p < end && !IS_SPACE(*p))
+		return p;
+
+	while (end - p >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(const void *)p);
+
+		m = (unsigned)_mm256_movemask_epi8(space_avx2(v));
+		if (m != 0xffffffffu)
+			return p + __builtin_ctz(~m);
+		p += 32;
+	}
+	return scan_space_sse2(p, end);
+}
+
+static AVX2 const char *
+scan_word_avx2(const char *p, const char *end, int *isnump) {
+	const __m256i zero = _mm256_set1_epi8('0');
+	const __m256i nine = _mm256_set1_epi8(9);
+	unsigned d, n, want;
+
+	while (end - p >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(const void *)p);
+		__m256i x = _mm256_sub_epi8(v, zero);
+		__m256i m = space_avx2(v);
+
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')));
+		d = (unsigned)_mm256_movemask_epi8(m);
+
+		m = _mm256_cmpeq_epi8(_mm256_min_epu8(x, nine), x);
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('.')));
+		n = (unsigned)_mm256_movemask_epi8(m);
+
+		if (d != 0) {
+			/* "1u << 32" is undefined, but ctz(d) < 32 here */
+			want = (1u << __builtin_ctz(d)) - 1;
+			if ((n & want) != want)
+				*isnump = 0;
+			return p + __builtin_ctz(d);
+		}
+		if (n != 0xffffffffu)
+			*isnump = 0;
+		p += 32;
+	}
+	return scan_word_sse2(p, end, isnump);
+}
+
+static AVX2 const char *
+scan_string_avx2(const char *p, const char *end) {
+	const __m256i at = _mm256_set1_epi8('@');
+	int pending = 0;
+	unsigned m;
+	int i;
+
+	while (end - p >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(const void *)p);
+
+		m = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, at));
+		if (pending) {
+			if (!(m & 1))
+				return p - 1;
+			m &= ~1u;
+			pending = 0;
+		}
+		while (m != 0) {
+			i = __builtin_ctz(m);
+			if (i == 31) {
+				pending = 1;
+				break;
+			}
+			if (!(m & (2u << i)))
+				return p + i;
+			m &= ~(3u << i);
+		}
+		p += 32;
+	}
+	if (pending) {
+		if (p == end || *p != '@')
+			return p - 1;
+		p++;
+	}
+	return scan_string_sse2(p, end);
+}
+
+static const struct scanner scan_avx2 = {
+	scan_space_avx2, scan_word_avx2, scan_string_avx2
+};
+#endif /* USE_AVX2 */
+
+const struct scanner *
+scan_select(void) {
+#ifdef USE_AVX2
+	if (__builtin_cpu_supports("avx2"))
+		return &scan_avx2;
+#endif
+#ifdef USE_SSE2
+	return &scan_sse2;
+#endif
+	return &scan_portable;
+}
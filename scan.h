@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2026 Thomas E. Dickey <dickey@invisible-island.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id: scan.h,v 1.1 2026/10/17 12:00:00 tom Exp $
+ */
+#ifndef SCAN_H
+#define SCAN_H
+
+/*
+ * Byte scanners used by the tokenizer.  There is a portable set and,
+ * where the compiler supports it, SSE2/AVX2 sets which look at 16 or 32
+ * bytes at a time.  scan_select() returns the best set for this CPU; it
+ * has no side effects, so each parser may call it for itself.
+ *
+ * space	returns the first byte which is not whitespace.
+ * word		returns the end of the word starting at p, and clears
+ *		*isnump if it contains anything other than digits and '.'.
+ * string	returns the '@' which ends the string starting at p,
+ *		skipping '@@' pairs, or NULL if there is none.
+ */
+struct scanner {
+	const char *(*space)(const char *p, const char *end);
+	const char *(*word)(const char *p, const char *end, int *isnump);
+	const char *(*string)(const char *p, const char *end);
+};
+
+const struct scanner *scan_select(void);
+
+#endif
@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) 2026 Thomas E. Dickey <dickey@invisible-island.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id: textcache.c,v 1.1 2026/10/17 12:00:00 tom Exp $
+ */
+
+#include "rcshist.h"
+
+#include <err.h>
+#include <pthread.h>
+
+#include "rcsfile.h"
+#include "textcache.h"
+
+/*
+ * Don't look further than this for a revision's cached ancestor when
+ * pricing it; one that far away is dear enough to keep.
+ */
+#define TC_MAXDIST	1024
+
+/*
+ * The cached revisions form a heap, cheapest to rebuild at the top, and
+ * each knows its place in it by revinfo.cacheslot (0 if not there).  The
+ * costs are worked out when a revision is added, and again before it is
+ * evicted, since its ancestors may have gone in the meantime.  A revision
+ * for which no room could be made is not put in the heap, but marked
+ * TC_UNKEPT, and its lines are freed once they are no longer in use,
+ * unless it is the last such, the spare: that one is kept until the next,
+ * so that working down a delta chain does not start again at its end.
+ */
+#define TC_UNKEPT	(-1)
+
+struct tc_entry {
+	unsigned long cost;
+	struct revnode *revp;
+};
+
+/*
+ * There is one cache, unless textcache_split() has made several, each for
+ * a group of files which the caller locks as one; a file's revisions are
+ * kept in rcsp->cache, or in the first cache if that is NULL.  The caches
+ * share the budget: the bytes of all of them are counted together, under
+ * their own lock, and each evicts only its own revisions.
+ */
+struct textcache {
+	struct tc_entry *heap;		/* heap[1..nheap] */
+	int nheap;
+	int heap_len;
+	struct revnode *spare;		/* the last revision not kept */
+
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+};
+
+static struct textcache *caches;
+static int ncaches;
+static size_t budget;			/* for all of them */
+
+static pthread_mutex_t bytes_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t bytes;			/* of the lines of all of them */
+static size_t peak;
+
+static struct textcache *tc_get(struct revnode *revp);
+static unsigned long tc_cost(struct revnode *revp);
+static size_t tc_size(struct revnode *revp);
+static int tc_charge(size_t size, int force);
+static void tc_set(struct textcache *tc, int i, struct tc_entry *ep);
+static void tc_delete(struct textcache *tc, int i);
+static void tc_up(struct textcache *tc, int i);
+static void tc_down(struct textcache *tc, int i);
+static int tc_evict(struct textcache *tc, size_t need);
+static void tc_free(struct revnode *revp);
+
+void
+textcache_setbudget(size_t size) {
+	budget = size;
+	textcache_split(1);
+}
+
+size_t
+textcache_budget(void) {
+	return budget;
+}
+
+/*
+ * Make n caches sharing the budget, while nothing is cached.
+ */
+void
+textcache_split(int n) {
+	int i;
+
+	for (i = 0; i < ncaches; i++)
+		if (caches[i].nheap != 0)
+			GIVE_UP();
+	for (i = 0; i < ncaches; i++)
+		free(caches[i].heap);
+	free(caches);
+
+	caches = calloc((size_t)n, sizeof(*caches));
+	ncaches = n;
+}
+
+/*
+ * The i'th of the caches made by textcache_split(), or NULL if there is
+ * no budget.
+ */
+struct textcache *
+textcache_get(int i) {
+	if (budget == 0)
+		return NULL;
+	if (i < 0 || i >= ncaches)
+		GIVE_UP();
+	return &caches[i];
+}
+
+/*
+ * Count a call of rev_calc() which found the lines of revp already
+ * built.  Each revision built instead is a miss, counted by
+ * textcache_add(), so that misses and evictions are both of revisions.
+ */
+void
+textcache_hit(struct revnode *revp) {
+	if (budget == 0)
+		return;
+	tc_get(revp)->hits++;
+}
+
+/*
+ * Account for the lines just built for revp, first evicting others to
+ * make room for them within the budget.  If all that could go are in
+ * use, revp is not kept, but built again when next wanted.
+ */
+void
+textcache_add(struct revnode *revp) {
+	struct textcache *tc;
+	struct revnode *spare;
+	struct tc_entry e;
+
+	if (budget == 0)
+		return;
+	tc = tc_get(revp);
+	tc->misses++;
+	if (!tc_evict(tc, tc_size(revp))) {
+		revp->info->cacheslot = TC_UNKEPT;
+		spare = tc->spare;
+		tc->spare = revp;
+		if (spare != NULL && spare->info->olrefs == 0)
+			tc_free(spare);
+		return;
+	}
+
+	if (tc->nheap + 1 >= tc->heap_len) {
+		tc->heap_len += tc->heap_len + 64;
+		tc->heap = realloc(tc->heap, (size_t)tc->heap_len *
+		    sizeof(*tc->heap));
+	}
+	e.cost = tc_cost(revp);
+	e.revp = revp;
+	tc_set(tc, ++tc->nheap, &e);
+	tc_up(tc, tc->nheap);
+}
+
+/*
+ * Forget revp, whose lines are about to be freed by the caller.
+ */
+void
+textcache_remove(struct revnode *revp) {
+	int i = revp->info->cacheslot;
+	size_t size;
+
+	if (i == 0)
+		return;
+	size = tc_size(revp);
+	pthread_mutex_lock(&bytes_lock);
+	bytes -= size;
+	pthread_mutex_unlock(&bytes_lock);
+	if (i != TC_UNKEPT)
+		tc_delete(tc_get(revp), i);
+	else if (tc_get(revp)->spare == revp)
+		tc_get(revp)->spare = NULL;
+	revp->info->cacheslot = 0;
+}
+
+/*
+ * Free the lines of revp, no longer in use, if they were not kept and
+ * are not the spare.
+ */
+void
+textcache_release(struct revnode *revp) {
+	if (revp->info->cacheslot == TC_UNKEPT && tc_get(revp)->spare != revp)
+		tc_free(revp);
+}
+
+/*
+ * Report the counts for all the caches.
+ */
+void
+textcache_report(void) {
+	unsigned long hits, misses, evictions;
+	int i;
+
+	hits = misses = evictions = 0;
+	for (i = 0; i < ncaches; i++) {
+		hits += caches[i].hits;
+		misses += caches[i].misses;
+		evictions += caches[i].evictions;
+	}
+	warnx("text cache: %lu hits, %lu misses, %lu evictions, "
+	    "peak %lu of %lu bytes", hits, misses, evictions,
+	    (unsigned long)peak, (unsigned long)budget);
+}
+
+static struct textcache *
+tc_get(struct revnode *revp) {
+	return (revp->rcsp->cache != NULL) ? revp->rcsp->cache : &caches[0];
+}
+
+/*
+ * What it would take to build revp again: the number of deltas back to
+ * the nearest revision still cached, times the size of its own delta.
+ */
+static unsigned long
+tc_cost(struct revnode *revp) {
+	struct revnode *rp;
+	unsigned long dist;
+
+	dist = 1;
+	for (rp = revp->patchprev; rp != NULL &&
+	    rp->info->outputlines == NULL && dist < TC_MAXDIST;
+	    rp = rp->patchprev)
+		dist++;
+	return dist * (unsigned long)(revp->info->text.len + 1);
+}
+
+static void
+tc_free(struct revnode *revp) {
+	struct revinfo *rip = revp->info;
+
+	textcache_remove(revp);
+	pt_destroy(rip->outputlines);
+	rip->outputlines = NULL;
+	revp->rcsp->nheaplines--;
+}
+
+/*
+ * The bytes taken by the lines of revp: its pieces, and the struct
+ * rcstext of each line, in the lines of the deltas the pieces point to.
+ */
+static size_t
+tc_size(struct revnode *revp) {
+	const struct piecetable *ptp = revp->info->outputlines;
+
+	return sizeof(*ptp) + (size_t)ptp->list_len * sizeof(*ptp->list) +
+	    (size_t)ptp->nlines * sizeof(struct rcstext);
+}
+
+/*
+ * Count size more bytes, if they fit in the budget or force is set, and
+ * return whether they were counted.
+ */
+static int
+tc_charge(size_t size, int force) {
+	int ok;
+
+	pthread_mutex_lock(&bytes_lock);
+	if ((ok = force || bytes + size <= budget) != 0) {
+		bytes += size;
+		if (bytes > peak)
+			peak = bytes;
+	}
+	pthread_mutex_unlock(&bytes_lock);
+	return ok;
+}
+
+static void
+tc_set(struct textcache *tc, int i, struct tc_entry *ep) {
+	tc->heap[i] = *ep;
+	tc->heap[i].revp->info->cacheslot = i;
+}
+
+/*
+ * Take the i'th out of the heap.
+ */
+static void
+tc_delete(struct textcache *tc, int i) {
+	tc->heap[i].revp->info->cacheslot = 0;
+	if (i != tc->nheap) {
+		tc_set(tc, i, &tc->heap[tc->nheap--]);
+		tc_up(tc, i);
+		tc_down(tc, i);
+	} else
+		tc->nheap--;
+}
+
+static void
+tc_up(struct textcache *tc, int i) {
+	struct tc_entry e = tc->heap[i];
+
+	while (i > 1 && tc->heap[i / 2].cost > e.cost) {
+		tc_set(tc, i, &tc->heap[i / 2]);
+		i /= 2;
+	}
+	tc_set(tc, i, &e);
+}
+
+static void
+tc_down(struct textcache *tc, int i) {
+	struct tc_entry e = tc->heap[i];
+	int j;
+
+	while ((j = 2 * i) <= tc->nheap) {
+		if (j < tc->nheap && tc->heap[j + 1].cost < tc->heap[j].cost)
+			j++;
+		if (tc->heap[j].cost >= e.cost)
+			break;
+		tc_set(tc, i, &tc->heap[j]);
+		i = j;
+	}
+	tc_set(tc, i, &e);
+}
+
+/*
+ * Drop the cheapest revisions, then the spare, until need more bytes fit
+ * in the budget, and count them, returning whether they fitted.  Those
+ * in use are set aside and put back afterwards.  If the rest were not
+ * enough, need is counted all the same, since the lines exist until they
+ * are freed.
+ */
+static int
+tc_evict(struct textcache *tc, size_t need) {
+	struct tc_entry *held = NULL;
+	struct revnode *revp;
+	struct revinfo *rip;
+	unsigned long cost;
+	int i, fits, nheld = 0;
+
+	while (!(fits = tc_charge(need, 0))) {
+		/* The spare goes last, if it is not in use */
+		if (tc->nheap == 0) {
+			if ((revp = tc->spare) == NULL ||
+			    revp->info->olrefs != 0)
+				break;
+			tc_free(revp);
+			tc->evictions++;
+			continue;
+		}
+		revp = tc->heap[1].revp;
+		rip = revp->info;
+
+		/* Re-price it, in case its ancestors have gone */
+		if ((cost = tc_cost(revp)) > tc->heap[1].cost) {
+			tc->heap[1].cost = cost;
+			tc_down(tc, 1);
+			if (tc->heap[1].revp != revp)
+				continue;
+		}
+
+		if (rip->olrefs != 0) {
+			held = realloc(held, (size_t)(nheld + 1) *
+			    sizeof(*held));
+			held[nheld] = tc->heap[1];
+			held[nheld++].cost = cost;
+			tc_delete(tc, 1);
+			continue;
+		}
+
+		textcache_remove(revp);
+		pt_destroy(rip->outputlines);
+		rip->outputlines = NULL;
+		revp->rcsp->nheaplines--;
+		tc->evictions++;
+	}
+
+	if (!fits)
+		tc_charge(need, 1);
+
+	for (i = 0; i < nheld; i++) {
+		tc_set(tc, ++tc->nheap, &held[i]);
+		tc_up(tc, tc->nheap);
+	}
+	free(held);
+	return fits;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2026 Thomas E. Dickey <dickey@invisible-island.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id: textcache.h,v 1.1 2026/10/17 12:00:00 tom Exp $
+ */
+#ifndef TEXTCACHE_H
+#define TEXTCACHE_H
+
+/*
+ * Keeps the output lines of revisions, across all files, within a budget
+ * of bytes, dropping first those cheapest to build again.  Lines which
+ * are in use can't be dropped; if there is no room for more, those just
+ * built are freed by textcache_release() once they are no longer in use.
+ * Unless a budget is set, none of this is done, and every revision built
+ * is kept (or, with RCSFILE_LOWMEM, dropped as rev_remref() sees fit).
+ */
+struct revnode;
+struct textcache;
+
+void textcache_setbudget(size_t bytes);
+size_t textcache_budget(void);
+void textcache_split(int n);
+struct textcache *textcache_get(int i);
+void textcache_hit(struct revnode *revp);
+void textcache_add(struct revnode *revp);
+void textcache_remove(struct revnode *revp);
+void textcache_release(struct revnode *revp);
+void textcache_report(void);
+
+#endif
@@ -0,0 +1,623 @@
+/*
+ * Copyright (c) 2026 Thomas E. Dickey <dickey@invisible-island.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id: walk.c,v 1.1 2026/10/17 12:00:00 tom Exp $
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "rcshist.h"
+#include "arena.h"
+#include "namedobjlist.h"
+#include "strbuf.h"
+#include "walk.h"
+
+/*
+ * The directories waiting to be read are on a stack shared by the
+ * threads, each of which reads one at a time, and adds what it found
+ * under the lock when done with it; with no threads, walk_next() reads
+ * them itself as it needs more.  Each thread keeps the names it makes
+ * in an arena of its own.  What is found in a directory, its files and
+ * warnings, is held there until all before it have been let out, so that
+ * these come in the same order however many threads there are: that of a
+ * single one, taking the paths given in turn and, depth first, each
+ * directory's files before its subdirectories.  The walk is over when the
+ * last directory has been let out.
+ *
+ * A file with more than one link is looked up by its device and inode
+ * when it is found, and left out if another name for it was found first,
+ * so which name is taken may depend on the threads.  With WALK_SORTED it
+ * is left out only if the other name comes first in the order of fts,
+ * and walk_sort() leaves out the names which do not.
+ */
+struct wdir {
+	struct wdir *next;		/* on the stack */
+	const char *path;
+	int rank;			/* of the path given it is under */
+	int skip;			/* the length of that path */
+	int read;
+	struct wdir *parent;
+	struct wdir *child;		/* the first */
+	struct wdir *sibling;		/* the next child of parent */
+	struct wfile *files;		/* found in it */
+	int nfiles;
+	Strbuf *warn;			/* or NULL; each ending in a NUL */
+};
+
+/* A file found; ino is 0 unless it has more than one link */
+struct wfile {
+	const char *path;
+	int rank;			/* as in struct wdir */
+	int skip;
+	dev_t dev;
+	ino_t ino;
+};
+
+/* The key for a file with more than one link */
+struct wlinkkey {
+	dev_t dev;
+	ino_t ino;
+};
+
+/* A path given, and which it is, for sorting them */
+struct wroot {
+	const char *path;
+	int index;
+};
+
+struct walker {
+	struct walk *wp;
+	struct arena *arena;
+	pthread_t thread;
+};
+
+struct walk {
+	int flags;
+
+	struct wdir *dirs;		/* waiting to be read */
+	struct wdir *emit;		/* the next to let out */
+	int done;
+
+	struct wfile *files;		/* let out */
+	int nfiles;
+	int files_len;
+	int next;			/* for walk_next() */
+	int sorted;
+
+	Namedobjlist *links;		/* wfile kept, by struct wlinkkey */
+
+	struct arena *arena;		/* for the paths given, and reading */
+	struct walker *walkers;
+	int nwalkers;			/* 0 to read in walk_next() */
+	pthread_mutex_t lock;
+	pthread_cond_t work;		/* a directory is waiting, or done */
+	pthread_cond_t found;		/* a file was found, or done */
+};
+
+static void *walk_worker(void *arg);
+static void walk_wait(struct walk *wp);
+static void walk_dir(struct walk *wp, struct arena *ap, struct wdir *dp);
+static int walk_link(struct walk *wp, struct arena *ap, struct wfile *fp);
+static void walk_found(struct walk *wp, struct wdir *dp, struct wdir *dirs,
+    struct wfile *files, int nfiles);
+static void walk_warn(struct wdir *dp, const char *fmt, ...);
+static void walk_emit(struct walk *wp);
+static void walk_finish(struct walk *wp);
+static const char *walk_join(struct arena *ap, const char *dir,
+    const char *name, size_t len);
+static void walk_addfile(struct walk *wp, struct wfile *fp);
+static void walk_sort(struct walk *wp);
+static int walk_rootcmp(const void *v1, const void *v2);
+static int walk_filecmp(const void *v1, const void *v2);
+static int walk_namecmp(const char *p1, const char *p2);
+
+struct walk *
+walk_start(char **paths, int npaths, int nthreads, int flags) {
+	struct walk *wp;
+	struct wdir *dp, *last;
+	struct wfile file;
+	struct wroot *byname;
+	struct stat sb;
+	int *rank;
+	int i, error;
+	size_t len;
+
+	wp = calloc(1, sizeof(*wp));
+	wp->flags = flags;
+	wp->arena = arena_create();
+	wp->links = namedobjlist_acreate(wp->arena);
+	pthread_mutex_init(&wp->lock, NULL);
+	pthread_cond_init(&wp->work, NULL);
+	pthread_cond_init(&wp->found, NULL);
+
+	byname = malloc((size_t)npaths * sizeof(*byname));
+	for (i = 0; i < npaths; i++) {
+		byname[i].path = paths[i];
+		byname[i].index = i;
+	}
+	if (npaths > 1)
+		qsort(byname, (size_t)npaths, sizeof(*byname), walk_rootcmp);
+	rank = malloc((size_t)npaths * sizeof(*rank));
+	for (i = 0; i < npaths; i++)
+		rank[byname[i].index] = i;
+	free(byname);
+
+	/* As fts with FTS_PHYSICAL, symbolic links are not followed */
+	last = NULL;
+	for (i = 0; i < npaths; i++) {
+		if (lstat(paths[i], &sb) != 0) {
+			warnx("%s: %s", paths[i], strerror(errno));
+			continue;
+		}
+		len = strlen(paths[i]);
+		if (len > 0 && paths[i][len - 1] == '/')
+			len--;
+		if (S_ISDIR(sb.st_mode)) {
+			dp = arena_alloc(wp->arena, sizeof(*dp));
+			bzero(dp, sizeof(*dp));
+			dp->path = paths[i];
+			dp->rank = rank[i];
+			dp->skip = (int)len;
+			if (last == NULL)
+				wp->dirs = wp->emit = dp;
+			else
+				last->next = last->sibling = dp;
+			last = dp;
+		} else if (S_ISREG(sb.st_mode)) {
+			file.path = paths[i];
+			file.rank = rank[i];
+			file.skip = (int)len;
+			file.dev = sb.st_dev;
+			file.ino = (sb.st_nlink > 1) ? sb.st_ino : 0;
+			if (file.ino == 0 || walk_link(wp, wp->arena, &file))
+				walk_addfile(wp, &file);
+		}
+	}
+	free(rank);
+	if (wp->emit == NULL)
+		walk_finish(wp);
+
+	/* One thread would only wait on walk_next(), so it reads instead */
+	if (nthreads < 2)
+		return wp;
+	wp->nwalkers = nthreads;
+	wp->walkers = calloc((size_t)nthreads, sizeof(*wp->walkers));
+	for (i = 0; i < nthreads; i++) {
+		wp->walkers[i].wp = wp;
+		wp->walkers[i].arena = arena_create();
+		if ((error = pthread_create(&wp->walkers[i].thread, NULL,
+		    walk_worker, &wp->walkers[i])) != 0)
+			errx(1, "pthread_create: %s", strerror(error));
+	}
+
+	return wp;
+}
+
+/*
+ * The next file, waiting for it to be found if need be, or NULL once all
+ * have been returned.
+ */
+const char *
+walk_next(struct walk *wp) {
+	const char *path = NULL;
+
+	pthread_mutex_lock(&wp->lock);
+	if ((wp->flags & WALK_SORTED) && !wp->sorted) {
+		while (!wp->done)
+			walk_wait(wp);
+		walk_sort(wp);
+		wp->sorted = 1;
+	}
+	while (wp->next == wp->nfiles && !wp->done)
+		walk_wait(wp);
+	if (wp->next < wp->nfiles)
+		path = wp->files[wp->next++].path;
+	pthread_mutex_unlock(&wp->lock);
+
+	return path;
+}
+
+void
+walk_free(struct walk *wp) {
+	int i;
+
+	for (i = 0; i < wp->nwalkers; i++) {
+		pthread_join(wp->walkers[i].thread, NULL);
+		arena_destroy(wp->walkers[i].arena);
+	}
+	free(wp->walkers);
+	arena_destroy(wp->arena);
+	free(wp->files);
+	namedobjlist_destroy(wp->links);
+	pthread_cond_destroy(&wp->work);
+	pthread_cond_destroy(&wp->found);
+	pthread_mutex_destroy(&wp->lock);
+	free(wp);
+}
+
+static void *
+walk_worker(void *arg) {
+	struct walker *wkp = arg;
+	struct walk *wp = wkp->wp;
+	struct wdir *dp;
+
+	pthread_mutex_lock(&wp->lock);
+	for (;;) {
+		while (wp->dirs == NULL && !wp->done)
+			pthread_cond_wait(&wp->work, &wp->lock);
+		if (wp->dirs == NULL)
+			break;
+		dp = wp->dirs;
+		wp->dirs = dp->next;
+		pthread_mutex_unlock(&wp->lock);
+
+		walk_dir(wp, wkp->arena, dp);
+
+		pthread_mutex_lock(&wp->lock);
+	}
+	pthread_mutex_unlock(&wp->lock);
+
+	return NULL;
+}
+
+/*
+ * Wait for more to be let out, with the lock held, or with no threads
+ * read the next directory, which is then on the stack.
+ */
+static void
+walk_wait(struct walk *wp) {
+	struct wdir *dp;
+
+	if (wp->nwalkers > 0) {
+		pthread_cond_wait(&wp->found, &wp->lock);
+		return;
+	}
+	dp = wp->dirs;
+	wp->dirs = dp->next;
+	pthread_mutex_unlock(&wp->lock);
+	walk_dir(wp, wp->arena, dp);
+	pthread_mutex_lock(&wp->lock);
+}
+
+/*
+ * Read the directory dp, and add the RCS files and directories in it.
+ * The type of each entry is taken from the directory where it is given,
+ * but an RCS file is looked up all the same, for the device and inode of
+ * what it links to; d_ino need not be that across a mount point, or on
+ * overlayfs.
+ */
+static void
+walk_dir(struct walk *wp, struct arena *ap, struct wdir *dp) {
+	struct wdir *dirs, *last, *sub;
+	struct wfile *files, *fp;
+	struct dirent *de;
+	struct stat sb;
+	DIR *dirp;
+	size_t len;
+	int fd, nfiles, files_len, type, isrcs;
+
+	if ((fd = open(dp->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW)) < 0 ||
+	    (dirp = fdopendir(fd)) == NULL) {
+		walk_warn(dp, "%s: %s", dp->path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		walk_found(wp, dp, NULL, NULL, 0);
+		return;
+	}
+
+	dirs = last = NULL;
+	files = NULL;
+	nfiles = files_len = 0;
+	while ((errno = 0, de = readdir(dirp)) != NULL) {
+		if (de->d_name[0] == '.' && (de->d_name[1] == '\0' ||
+		    (de->d_name[1] == '.' && de->d_name[2] == '\0')))
+			continue;
+		len = strlen(de->d_name);
+		type = de->d_type;
+		isrcs = len > 2 && strcmp(de->d_name + len - 2, ",v") == 0;
+		if (type == DT_UNKNOWN || (type == DT_REG && isrcs)) {
+			if (fstatat(fd, de->d_name, &sb,
+			    AT_SYMLINK_NOFOLLOW) != 0) {
+				walk_warn(dp, "%s/%s: %s", dp->path,
+				    de->d_name, strerror(errno));
+				continue;
+			}
+			type = S_ISDIR(sb.st_mode) ? DT_DIR :
+			    S_ISREG(sb.st_mode) ? DT_REG : DT_UNKNOWN;
+		}
+
+		if (type == DT_DIR) {
+			sub = arena_alloc(ap, sizeof(*sub));
+			bzero(sub, sizeof(*sub));
+			sub->path = walk_join(ap, dp->path, de->d_name, len);
+			sub->rank = dp->rank;
+			sub->skip = dp->skip;
+			sub->parent = dp;
+			if (last == NULL)
+				dirs = sub;
+			else
+				last->next = last->sibling = sub;
+			last = sub;
+		} else if (type == DT_REG && isrcs) {
+			if (nfiles == files_len) {
+				files_len += files_len + 16;
+				files = realloc(files, (size_t)files_len *
+				    sizeof(*files));
+			}
+			fp = &files[nfiles];
+			fp->path = walk_join(ap, dp->path, de->d_name, len);
+			fp->rank = dp->rank;
+			fp->skip = dp->skip;
+			fp->dev = sb.st_dev;
+			fp->ino = (sb.st_nlink > 1) ? sb.st_ino : 0;
+			if (fp->ino == 0 || walk_link(wp, ap, fp))
+				nfiles++;
+		}
+	}
+	if (errno != 0)
+		walk_warn(dp, "%s: %s", dp->path, strerror(errno));
+	closedir(dirp);
+
+	walk_found(wp, dp, dirs, files, nfiles);
+}
+
+/*
+ * Note fp, a file with more than one link, and return whether to take
+ * it: if no other name for it has been found, or with WALK_SORTED if it
+ * comes before the one that was.
+ */
+static int
+walk_link(struct walk *wp, struct arena *ap, struct wfile *fp) {
+	struct wlinkkey key;
+	struct wfile *kept;
+	int take = 1;
+
+	bzero(&key, sizeof(key));
+	key.dev = fp->dev;
+	key.ino = fp->ino;
+	pthread_mutex_lock(&wp->lock);
+	if ((kept = namedobjlist_lookup(wp->links, &key,
+	    (long)sizeof(key))) == NULL) {
+		kept = arena_alloc(ap, sizeof(*kept));
+		*kept = *fp;
+		namedobjlist_additem(wp->links, &key, (long)sizeof(key), kept);
+	} else if ((wp->flags & WALK_SORTED) && walk_filecmp(fp, kept) < 0)
+		*kept = *fp;
+	else
+		take = 0;
+	pthread_mutex_unlock(&wp->lock);
+	return take;
+}
+
+/*
+ * Put what was found in dp in it, the subdirectories dirs on the stack,
+ * and let out what can be.
+ */
+static void
+walk_found(struct walk *wp, struct wdir *dp, struct wdir *dirs,
+    struct wfile *files, int nfiles) {
+	struct wdir *last;
+
+	pthread_mutex_lock(&wp->lock);
+	dp->files = files;
+	dp->nfiles = nfiles;
+	dp->child = dirs;
+	dp->read = 1;
+	if (dirs != NULL) {
+		for (last = dirs; last->next != NULL; last = last->next)
+			;
+		last->next = wp->dirs;
+		wp->dirs = dirs;
+		pthread_cond_broadcast(&wp->work);
+	}
+	walk_emit(wp);
+	pthread_mutex_unlock(&wp->lock);
+}
+
+/*
+ * Note a warning about dp, to be given when what was found in it is let
+ * out.
+ */
+static void
+walk_warn(struct wdir *dp, const char *fmt, ...) {
+	va_list ap;
+
+	if (dp->warn == NULL)
+		dp->warn = sb_create();
+	va_start(ap, fmt);
+	sb_vappendf(dp->warn, fmt, ap);
+	va_end(ap);
+	sb_appendchar(dp->warn, '\0');
+}
+
+/*
+ * Let out the files and warnings of the directories read, in order, from
+ * the next, with the lock held.
+ */
+static void
+walk_emit(struct walk *wp) {
+	struct wdir *dp;
+	char *p, *end;
+	int i, n = wp->nfiles;
+
+	while ((dp = wp->emit) != NULL && dp->read) {
+		if (dp->warn != NULL) {
+			p = sb_ptr(dp->warn);
+			end = p + sb_len(dp->warn);
+			for (; p < end; p += strlen(p) + 1)
+				warnx("%s", p);
+			sb_free(dp->warn);
+			dp->warn = NULL;
+		}
+		for (i = 0; i < dp->nfiles; i++)
+			walk_addfile(wp, &dp->files[i]);
+		free(dp->files);
+		dp->files = NULL;
+
+		if (dp->child != NULL)
+			wp->emit = dp->child;
+		else {
+			while (dp != NULL && dp->sibling == NULL)
+				dp = dp->parent;
+			wp->emit = (dp != NULL) ? dp->sibling : NULL;
+		}
+	}
+	if (wp->emit == NULL)
+		walk_finish(wp);
+	else if (wp->nfiles != n)
+		pthread_cond_broadcast(&wp->found);
+}
+
+/*
+ * End the walk, with the lock held.
+ */
+static void
+walk_finish(struct walk *wp) {
+	wp->done = 1;
+	pthread_cond_broadcast(&wp->work);
+	pthread_cond_broadcast(&wp->found);
+}
+
+/*
+ * dir/name, as fts makes it, with no second '/' if dir ends in one.
+ */
+static const char *
+walk_join(struct arena *ap, const char *dir, const char *name, size_t len) {
+	size_t dlen = strlen(dir);
+	char *p;
+
+	if (dlen > 0 && dir[dlen - 1] == '/')
+		dlen--;
+	p = arena_alloc(ap, dlen + len + 2);
+	bcopy(dir, p, dlen);
+	p[dlen] = '/';
+	bcopy(name, p + dlen + 1, len + 1);
+	return p;
+}
+
+/*
+ * Add a file let out, with the lock held.
+ */
+static void
+walk_addfile(struct walk *wp, struct wfile *fp) {
+	if (wp->nfiles == wp->files_len) {
+		wp->files_len += wp->files_len + 64;
+		wp->files = realloc(wp->files, (size_t)wp->files_len *
+		    sizeof(*wp->files));
+	}
+	wp->files[wp->nfiles++] = *fp;
+}
+
+/*
+ * Put the files in the order of fts: the paths given sorted, and under
+ * each the entries of a directory sorted by name, each directory's
+ * before those of the next entry.  Of each file with more than one link
+ * only the name noted by walk_link() is kept.
+ */
+static void
+walk_sort(struct walk *wp) {
+	struct wlinkkey key;
+	struct wfile *fp, *kept;
+	int i, n;
+
+	bzero(&key, sizeof(key));
+	for (i = n = 0; i < wp->nfiles; i++) {
+		fp = &wp->files[i];
+		if (fp->ino != 0) {
+			key.dev = fp->dev;
+			key.ino = fp->ino;
+			kept = namedobjlist_lookup(wp->links, &key,
+			    (long)sizeof(key));
+			if (kept->path != fp->path)
+				continue;
+		}
+		wp->files[n++] = *fp;
+	}
+	wp->nfiles = n;
+	if (n > 1)
+		qsort(wp->files, (size_t)n, sizeof(*wp->files), walk_filecmp);
+}
+
+static int
+walk_rootcmp(const void *v1, const void *v2) {
+	const struct wroot *r1 = v1;
+	const struct wroot *r2 = v2;
+	int ret;
+
+	if ((ret = strcoll(r1->path, r2->path)) != 0)
+		return ret;
+	return (r1->index < r2->index) ? -1 : (r1->index > r2->index);
+}
+
+static int
+walk_filecmp(const void *v1, const void *v2) {
+	const struct wfile *f1 = v1;
+	const struct wfile *f2 = v2;
+	const char *p1, *p2;
+
+	if (f1->rank != f2->rank)
+		return (f1->rank < f2->rank) ? -1 : 1;
+
+	/* Compare what follows the path given, a name at a time */
+	p1 = f1->path + f1->skip;
+	p2 = f2->path + f2->skip;
+	if (*p1 == '\0' || *p2 == '\0')
+		return (*p1 != '\0') - (*p2 != '\0');
+	return walk_namecmp(p1 + 1, p2 + 1);
+}
+
+/*
+ * Compare two relative paths by their first name that differs.
+ */
+static int
+walk_namecmp(const char *p1, const char *p2) {
+	char n1[NAME_MAX + 1], n2[NAME_MAX + 1];
+	size_t l1, l2;
+	int ret;
+
+	for (;;) {
+		l1 = strcspn(p1, "/");
+		l2 = strcspn(p2, "/");
+		if (l1 > NAME_MAX || l2 > NAME_MAX)
+			return strcmp(p1, p2);
+		bcopy(p1, n1, l1);
+		n1[l1] = '\0';
+		bcopy(p2, n2, l2);
+		n2[l2] = '\0';
+		if ((ret = strcoll(n1, n2)) != 0)
+			return ret;
+		if (p1[l1] == '\0' || p2[l2] == '\0')
+			return (p1[l1] != '\0') - (p2[l2] != '\0');
+		p1 += l1 + 1;
+		p2 += l2 + 1;
+	}
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2026 Thomas E. Dickey <dickey@invisible-island.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id: walk.h,v 1.1 2026/10/17 12:00:00 tom Exp $
+ */
+#ifndef WALK_H
+#define WALK_H
+
+/*
+ * Finds the RCS files under the paths given to -R, reading nthreads
+ * directories at a time, or with fewer than two reading them in
+ * walk_next().  From the directories only names ending in ",v" are
+ * taken, Attic directories included, and a file with more than one link
+ * is taken once, by the name found first; a path given which is not a
+ * directory is taken as it is.  walk_next() returns the files as they
+ * are found, in the same order however many threads there are, or with
+ * WALK_SORTED, once all are found, in the order fts(3) would give with
+ * names compared by strcoll(), and a file with more than one link by
+ * the name which comes first in that order.  The names last until
+ * walk_free().
+ */
+#define WALK_SORTED	0x0001
+
+struct walk;
+
+struct walk *walk_start(char **paths, int npaths, int nthreads, int flags);
+const char *walk_next(struct walk *wp);
+void walk_free(struct walk *wp);
+
+#endif